@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <unordered_map>
+#include "components.h"
+
+using namespace std;
+
+namespace ptv {
+
+//Root of an id, halving the path on the way so later lookups are shorter
+int32_t findRoot(vector<int32_t> &parent, int32_t id){
+    while(parent[id] != id){
+        parent[id] = parent[parent[id]];
+        id = parent[id];
+    }
+    return id;
+}
+
+//The smaller id becomes the root, so every id is larger than its root
+void unite(vector<int32_t> &parent, int32_t a, int32_t b){
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if(a < b){
+        parent[b] = a;
+    }
+    else if(b < a){
+        parent[a] = b;
+    }
+}
+
+void addPixel(ComponentStats &s, int x, int y, bool border){
+    s.area++;
+    s.minX = min(s.minX, x);
+    s.minY = min(s.minY, y);
+    s.maxX = max(s.maxX, x);
+    s.maxY = max(s.maxY, y);
+    if(x < s.firstX || (x == s.firstX && y < s.firstY)){
+        s.firstX = x;
+        s.firstY = y;
+    }
+    if(border){
+        s.borderPixels++;
+    }
+}
+
+void mergeStats(ComponentStats &s, const ComponentStats &other){
+    s.area += other.area;
+    s.minX = min(s.minX, other.minX);
+    s.minY = min(s.minY, other.minY);
+    s.maxX = max(s.maxX, other.maxX);
+    s.maxY = max(s.maxY, other.maxY);
+    if(other.firstX < s.firstX || (other.firstX == s.firstX && other.firstY < s.firstY)){
+        s.firstX = other.firstX;
+        s.firstY = other.firstY;
+    }
+    s.borderPixels += other.borderPixels;
+}
+
+void labelComponents(const LabelImage &labels, ComponentImage &components, int threads){
+    int width = labels.width;
+    int height = labels.height;
+    const uint16_t *label = labels.labels.data();
+    components.width = width;
+    components.height = height;
+    components.ids.resize((size_t)width * height);
+    components.stats.clear();
+    int32_t *ids = components.ids.data();
+
+    threads = max(1, min(threads, height));
+    auto bandStart = [&](int band){
+        return (int)((long long)height * band / threads);
+    };
+
+    //First pass: provisional ids from the left and upper neighbors, each band on its own
+    vector<vector<int32_t>> bandParent(threads);
+    parallelFor(threads, threads, [&](int begin, int end, int /*t*/){
+        for(int band = begin; band < end; band++){
+            vector<int32_t> &parent = bandParent[band];
+            int firstRow = bandStart(band);
+            for(int y = firstRow; y < bandStart(band + 1); y++){
+                for(int x = 0; x < width; x++){
+                    size_t p = (size_t)y * width + x;
+                    bool left = x > 0 && label[p-1] == label[p];
+                    bool up = y > firstRow && label[p-width] == label[p];
+                    if(left && up){
+                        ids[p] = ids[p-1];
+                        if(ids[p-width] != ids[p-1]){
+                            unite(parent, ids[p-1], ids[p-width]);
+                        }
+                    }
+                    else if(left){
+                        ids[p] = ids[p-1];
+                    }
+                    else if(up){
+                        ids[p] = ids[p-width];
+                    }
+                    else {
+                        ids[p] = parent.size();
+                        parent.push_back(ids[p]);
+                    }
+                }
+            }
+        }
+    });
+
+    //Each band's ids follow the ones of the bands above, keeping every id larger than its root
+    vector<int32_t> bandOffset(threads + 1, 0);
+    for(int band = 0; band < threads; band++){
+        bandOffset[band + 1] = bandOffset[band] + bandParent[band].size();
+    }
+    vector<int32_t> parent(bandOffset[threads]);
+    parallelFor(threads, threads, [&](int begin, int end, int /*t*/){
+        for(int band = begin; band < end; band++){
+            int32_t offset = bandOffset[band];
+            for(int32_t i = 0; i < bandParent[band].size(); i++){
+                parent[offset + i] = bandParent[band][i] + offset;
+            }
+            if(offset == 0){
+                continue;
+            }
+            for(size_t p = (size_t)bandStart(band) * width; p < (size_t)bandStart(band + 1) * width; p++){
+                ids[p] += offset;
+            }
+        }
+    });
+    bandParent.clear();
+
+    //Seams: join the first row of every band with the last row of the band above
+    for(int band = 1; band < threads; band++){
+        size_t row = (size_t)bandStart(band) * width;
+        for(int x = 0; x < width; x++){
+            size_t p = row + x;
+            if(label[p] == label[p-width]){
+                unite(parent, ids[p], ids[p-width]);
+            }
+        }
+    }
+
+    //Roots get consecutive final ids, every other id comes after its root so it is already resolved
+    vector<int32_t> finalId(parent.size());
+    //Final ids whose root lies in each band
+    vector<int32_t> bandFirstId(threads + 1, 0);
+    for(int band = 0; band < threads; band++){
+        bandFirstId[band] = components.stats.size();
+        for(int32_t i = bandOffset[band]; i < bandOffset[band + 1]; i++){
+            if(parent[i] == i){
+                finalId[i] = components.stats.size();
+                components.stats.push_back({0, 0, INT32_MAX, INT32_MAX, -1, -1, 0, INT32_MAX, INT32_MAX});
+            }
+            else {
+                finalId[i] = finalId[findRoot(parent, i)];
+            }
+        }
+    }
+    bandFirstId[threads] = components.stats.size();
+
+    /*
+    Second pass: final ids and stats
+    A band writes the stats of components rooted in it directly, components reaching in
+    from the bands above are summed on the side and added once every band is done
+    */
+    vector<unordered_map<int32_t, ComponentStats>> foreignStats(threads);
+    parallelFor(threads, threads, [&](int begin, int end, int /*t*/){
+        for(int band = begin; band < end; band++){
+            unordered_map<int32_t, ComponentStats> &foreign = foreignStats[band];
+            for(int y = bandStart(band); y < bandStart(band + 1); y++){
+                for(int x = 0; x < width; x++){
+                    size_t p = (size_t)y * width + x;
+                    int32_t id = finalId[ids[p]];
+                    ids[p] = id;
+
+                    bool border = x == 0 || x == width-1 || y == 0 || y == height-1 ||
+                        label[p-1] != label[p] || label[p+1] != label[p] || label[p-width] != label[p] || label[p+width] != label[p];
+                    if(id >= bandFirstId[band]){
+                        components.stats[id].label = label[p];
+                        addPixel(components.stats[id], x, y, border);
+                    }
+                    else {
+                        auto entry = foreign.emplace(id, ComponentStats{label[p], 0, INT32_MAX, INT32_MAX, -1, -1, 0, INT32_MAX, INT32_MAX}).first;
+                        addPixel(entry->second, x, y, border);
+                    }
+                }
+            }
+        }
+    });
+    for(int band = 1; band < threads; band++){
+        for(auto it = foreignStats[band].begin(); it != foreignStats[band].end(); it++){
+            mergeStats(components.stats[it->first], it->second);
+        }
+    }
+}
+
+}
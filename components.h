@@ -0,0 +1,47 @@
+#ifndef PTV_COMPONENTS_H
+#define PTV_COMPONENTS_H
+
+#include <cstdint>
+#include <vector>
+#include "converter.h"
+
+namespace ptv {
+
+//Summary of one connected area of a single label
+typedef struct ComponentStats {
+    uint16_t label;
+    int area;
+    //Bounding box, inclusive
+    int minX;
+    int minY;
+    int maxX;
+    int maxY;
+    //Pixels on the image edge or next to a different label
+    int borderPixels;
+    //First pixel in column major order, where a column by column scan would find the component
+    int firstX;
+    int firstY;
+} ComponentStats;
+
+//Component id of every pixel and the stats of every component
+typedef struct ComponentImage {
+    int width = 0;
+    int height = 0;
+    std::vector<int32_t> ids;
+    std::vector<ComponentStats> stats;
+} ComponentImage;
+
+/*
+Splits the label image into 4-connected areas of equal labels
+Two raster passes: the first gives every pixel a provisional id and records which ids touch
+in a union-find forest, the second resolves each pixel to its final id and gathers the stats
+
+The image is cut into one band of rows per thread and both passes run on the bands in parallel
+Between the passes the band forests are joined and the rows on either side of each seam are united
+Component ids depend on the number of bands, their stats (including firstX/firstY) do not
+*/
+void labelComponents(const LabelImage &labels, ComponentImage &components, int threads);
+
+}
+
+#endif
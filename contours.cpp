@@ -0,0 +1,105 @@
+#include <algorithm>
+#include "contours.h"
+
+using namespace std;
+
+namespace ptv {
+
+/*
+Directions, each one a right turn from the last: east, south, west, north (y grows downwards)
+Walking direction d from corner (x, y), the region is always on the right hand side
+*/
+const int stepX[4] = {1, 0, -1, 0};
+const int stepY[4] = {0, 1, 0, -1};
+
+//Pixel on the right of the crack leaving corner (x, y) in direction d, the crack is side d of that pixel
+const int rightPixelX[4] = {0, -1, -1, 0};
+const int rightPixelY[4] = {0, 0, -1, -1};
+
+//Pixels ahead of corner (x, y) when arriving in direction d, on the right and on the left
+const int aheadRightX[4] = {0, -1, -1, 0};
+const int aheadRightY[4] = {0, 0, -1, -1};
+const int aheadLeftX[4] = {0, 0, -1, -1};
+const int aheadLeftY[4] = {-1, 0, 0, -1};
+
+//Corner a crack on the given side of pixel (x, y) starts from, walked with the pixel on its right
+const int sideStartX[4] = {0, 1, 1, 0};
+const int sideStartY[4] = {0, 0, 1, 1};
+//Neighbor across each side: top, right, bottom, left (the side a crack of direction d lies on)
+const int sideNeighborX[4] = {0, 1, 0, -1};
+const int sideNeighborY[4] = {-1, 0, 1, 0};
+
+void traceContours(const LabelImage &labels, uint16_t label, vector<Coordinate> &borderPixels,
+                   vector<uint8_t> &visitedCracks, vector<Loop*> &loops){
+    int width = labels.width;
+    int height = labels.height;
+    auto inside = [&](int x, int y){
+        return x >= 0 && y >= 0 && x < width && y < height && labels.labels[(size_t)y * width + x] == label;
+    };
+    //Label of a pixel, outside the image counts as one more label
+    auto labelAt = [&](int x, int y) -> int {
+        return x >= 0 && y >= 0 && x < width && y < height ? labels.labels[(size_t)y * width + x] : -1;
+    };
+    //Three or four cracks meet at a corner where three areas (or two diagonal ones) come together
+    //The corners of the image are kept as junctions too, so simplifying never cuts them off
+    auto junction = [&](int x, int y){
+        if((x == 0 || x == width) && (y == 0 || y == height)){
+            return true;
+        }
+        int a = labelAt(x-1, y-1);
+        int b = labelAt(x, y-1);
+        int c = labelAt(x, y);
+        int d = labelAt(x-1, y);
+        return (a != b) + (b != c) + (c != d) + (d != a) > 2;
+    };
+
+    //Column major order puts the top of the leftmost column first, its top crack is on the outer boundary
+    std::sort(borderPixels.begin(), borderPixels.end(), [](const Coordinate &a, const Coordinate &b){
+        return a.x != b.x ? a.x < b.x : a.y < b.y;
+    });
+
+    for(int i = 0; i < borderPixels.size(); i++){
+        Coordinate p = borderPixels[i];
+        for(int side = 0; side < 4; side++){
+            uint8_t &visited = visitedCracks[(size_t)p.y * width + p.x];
+            if((visited & (1 << side)) || inside(p.x + sideNeighborX[side], p.y + sideNeighborY[side])){
+                continue;
+            }
+
+            Loop *loop = new Loop();
+            loop->color = labels.palette[label];
+
+            int startX = p.x + sideStartX[side];
+            int startY = p.y + sideStartY[side];
+            int x = startX;
+            int y = startY;
+            int d = side;
+            do {
+                visitedCracks[(size_t)(y + rightPixelY[d]) * width + x + rightPixelX[d]] |= 1 << d;
+                x += stepX[d];
+                y += stepY[d];
+
+                //Turn right as soon as the region ends ahead, left when it continues around the corner
+                int next = d;
+                if(!inside(x + aheadRightX[d], y + aheadRightY[d])){
+                    next = (d + 1) % 4;
+                }
+                else if(inside(x + aheadLeftX[d], y + aheadLeftY[d])){
+                    next = (d + 3) % 4;
+                }
+                bool meeting = junction(x, y);
+                if(next != d || meeting){
+                    loop->pixels.push_back({x, y});
+                    loop->junctions.push_back(meeting);
+                }
+                d = next;
+            } while(x != startX || y != startY || d != side);
+
+            loop->length = loop->pixels.size();
+            loop->closed = true;
+            loops.push_back(loop);
+        }
+    }
+}
+
+}
@@ -0,0 +1,35 @@
+#ifndef PTV_CONTOURS_H
+#define PTV_CONTOURS_H
+
+#include <cstdint>
+#include <vector>
+#include "converter.h"
+
+namespace ptv {
+
+/*
+Crack following contour tracer
+
+Contours run along the edges between pixels (cracks), so a loop's vertices are pixel corners:
+a region made of pixel (x, y) alone is the square (x, y) (x+1, y) (x+1, y+1) (x, y+1)
+Only the corners where the contour turns or meets other borders (junctions) are kept,
+straight runs become a single segment
+
+The region is the 4-connected area of one label, so two pixels touching only at a corner are kept apart
+Every step looks at the two pixels ahead and turns without backtracking, so each loop is closed
+and takes time linear in its length
+*/
+
+/*
+Traces every boundary of the region of the given label that borderPixels belong to
+The first loop is the outer boundary, any further loops are holes
+borderPixels must hold every pixel of the region next to another label or the image edge, it gets sorted
+visitedCracks holds 4 bits per pixel of the image (sized by the caller, zeroed once)
+Regions never share pixels, so the same buffer can be passed for every region of an image
+*/
+void traceContours(const LabelImage &labels, uint16_t label, std::vector<Coordinate> &borderPixels,
+                   std::vector<uint8_t> &visitedCracks, std::vector<Loop*> &loops);
+
+}
+
+#endif
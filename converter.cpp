@@ -0,0 +1,2223 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <cmath>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <stdexcept>
+#include "converter.h"
+#include "components.h"
+#include "contours.h"
+#include "palette.h"
+#include "topology.h"
+#include "raymath.h"
+
+using namespace std;
+
+namespace ptv {
+
+int stageThreads(ConvertContext &ctx, size_t work, size_t minWorkPerThread){
+    int threads = ctx.options.threads;
+    if(threads <= 0){
+        threads = max(1, (int)thread::hardware_concurrency());
+    }
+    size_t useful = max((size_t)1, work / max((size_t)1, minWorkPerThread));
+    return (int)min((size_t)threads, useful);
+}
+
+void parallelFor(int count, int threads, const function<void(int begin, int end, int thread)> &body){
+    if(threads <= 1 || count <= 1){
+        body(0, count, 0);
+        return;
+    }
+    threads = min(threads, count);
+    vector<thread> workers;
+    for(int t = 1; t < threads; t++){
+        workers.emplace_back(body, (int)((long long)count * t / threads), (int)((long long)count * (t+1) / threads), t);
+    }
+    body(0, count / threads, 0);
+    for(int t = 0; t < workers.size(); t++){
+        workers[t].join();
+    }
+}
+
+/*
+Direct access to the pixels of an R8G8B8A8 image
+The format is checked once when the view is made instead of on every pixel like GetImageColor/ImageDrawPixel
+*/
+typedef struct RgbaView {
+    Color *pixels;
+    int width;
+    int height;
+    //Distance between rows, in pixels
+    int stride;
+
+    Color &at(int x, int y) const {
+        return pixels[(size_t)y * stride + x];
+    }
+    Color *row(int y) const {
+        return pixels + (size_t)y * stride;
+    }
+} RgbaView;
+
+RgbaView viewImage(Image &image){
+    if(image.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8){
+        ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    }
+    RgbaView view;
+    view.pixels = (Color *)image.data;
+    view.width = image.width;
+    view.height = image.height;
+    view.stride = image.width;
+    return view;
+}
+
+//Colors are packed into one 32-bit key (r in the low byte) for histogram lookups
+inline uint32_t packColor(Color c){
+    return (uint32_t)c.r | ((uint32_t)c.g << 8) | ((uint32_t)c.b << 16) | ((uint32_t)c.a << 24);
+}
+
+//Key a pixel is counted and looked up under, every fully transparent pixel shares the key 0
+inline uint32_t pixelKey(Color c){
+    return c.a == 0 ? 0 : packColor(c);
+}
+
+inline Color unpackColor(uint32_t key){
+    return {(unsigned char)(key & 0xFF), (unsigned char)((key >> 8) & 0xFF), (unsigned char)((key >> 16) & 0xFF), (unsigned char)(key >> 24)};
+}
+
+//Most common first, ties broken by color so the order doesn't depend on histogram layout
+bool compColor(const ColorRecord &a, const ColorRecord &b) {
+    if(a.count != b.count){
+        return a.count > b.count;
+    }
+    return packColor({a.r, a.g, a.b, a.a}) < packColor({b.r, b.g, b.b, b.a});
+}
+
+/*
+Counts how often each packed color occurs
+Open addressing with linear probing in power of two sized arrays, a count of 0 marks an empty slot
+*/
+typedef struct ColorHistogram {
+    vector<uint32_t> keys;
+    vector<int> counts;
+    size_t used = 0;
+    int shift = 22;
+
+    ColorHistogram(){
+        keys.assign((size_t)1 << (32 - shift), 0);
+        counts.assign(keys.size(), 0);
+    }
+
+    size_t slotFor(uint32_t key) const {
+        //Fibonacci hashing spreads the packed channels over the whole table
+        size_t mask = keys.size() - 1;
+        size_t slot = (size_t)((key * 2654435769u) >> shift);
+        while(counts[slot] != 0 && keys[slot] != key){
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    void add(uint32_t key, int count = 1){
+        size_t slot = slotFor(key);
+        if(counts[slot] == 0){
+            keys[slot] = key;
+            used++;
+            //Keep the load factor under one half so probe runs stay short
+            if(used * 2 > keys.size()){
+                counts[slot] = count;
+                grow();
+                return;
+            }
+        }
+        counts[slot] += count;
+    }
+
+    void grow(){
+        vector<uint32_t> oldKeys;
+        vector<int> oldCounts;
+        oldKeys.swap(keys);
+        oldCounts.swap(counts);
+
+        shift--;
+        keys.assign(oldKeys.size() * 2, 0);
+        counts.assign(oldKeys.size() * 2, 0);
+        for(size_t i = 0; i < oldKeys.size(); i++){
+            if(oldCounts[i] != 0){
+                size_t slot = slotFor(oldKeys[i]);
+                keys[slot] = oldKeys[i];
+                counts[slot] = oldCounts[i];
+            }
+        }
+    }
+
+    size_t size() const {
+        return used;
+    }
+
+    void merge(const ColorHistogram &other){
+        for(size_t i = 0; i < other.keys.size(); i++){
+            if(other.counts[i] != 0){
+                add(other.keys[i], other.counts[i]);
+            }
+        }
+    }
+
+    void toRecords(vector<ColorRecord> &records) const {
+        records.reserve(records.size() + used);
+        for(size_t i = 0; i < keys.size(); i++){
+            if(counts[i] != 0){
+                Color c = unpackColor(keys[i]);
+                records.push_back({c.r, c.g, c.b, c.a, counts[i]});
+            }
+        }
+    }
+} ColorHistogram;
+
+float ColorDistance(Color a, Color b){
+    return sqrtf((a.r - b.r)*(a.r - b.r) + (a.g - b.g)*(a.g - b.g) + (a.b - b.b)*(a.b - b.b) + (a.a - b.a)*(a.a - b.a));
+}
+
+//Pixels counted when sampleStride is 0, the stride is picked to land near this
+const double autoSamplePixels = 4 << 20;
+
+//Set on labels of pixels refineBorders has already assigned to a region
+const uint16_t clearedLabel = 0x8000;
+const uint16_t labelMask = 0x7FFF;
+
+//Cell of the merge grid, one axis per channel with side cells each
+inline uint64_t gridCell(int x, int y, int z, int w, int side){
+    return (((uint64_t)x * side + y) * side + z) * side + w;
+}
+
+/*
+Builds the palette lookup table if the options ask for it
+In auto mode the table is only built when the expected lookups outweigh its build cost,
+roughly one palette scan per cell against one (8 wide) scan per lookup
+*/
+void usePaletteEngine(ConvertContext &ctx, PaletteMatcher &matcher, size_t lookups){
+    PaletteEngine engine = ctx.options.paletteEngine;
+    if(engine == PALETTE_ENGINE_AUTO){
+        engine = lookups > 8 * PaletteMatcher::lookupTableCells(ctx.options.lutBits) ? PALETTE_ENGINE_LUT : PALETTE_ENGINE_SEARCH;
+    }
+    if(engine == PALETTE_ENGINE_LUT){
+        int threads = stageThreads(ctx, PaletteMatcher::lookupTableCells(ctx.options.lutBits) * matcher.size, 1 << 22);
+        matcher.buildLookupTable(ctx.options.lutBits, threads);
+    }
+}
+
+//Merges colors closer than hashWidth into the most common of them, found through a grid of hashWidth sized cells
+void mergeSimilarColors(ConvertContext &ctx, vector<ColorRecord> &recordedColors){
+    int hashWidth = ctx.options.hashWidth;
+
+    std::sort(recordedColors.begin(), recordedColors.end(), compColor);
+
+    /*
+    Grouping alike colors using a 4D grid
+    Colors closer than hashWidth are at most one cell apart on every channel,
+    so the 3x3x3x3 cells around a color hold all of its merge candidates
+    */
+    int side = 255 / hashWidth + 1;
+
+    //(cell, index) of every recorded color, sorted so each cell is one contiguous run
+    vector<pair<uint64_t, int>> cellIndex(recordedColors.size());
+    for(int i = 0; i < recordedColors.size(); i++){
+        cellIndex[i].first = gridCell(recordedColors[i].r / hashWidth, recordedColors[i].g / hashWidth, recordedColors[i].b / hashWidth, recordedColors[i].a / hashWidth, side);
+        cellIndex[i].second = i;
+    }
+    std::sort(cellIndex.begin(), cellIndex.end());
+
+    //Start and end of the run of each occupied cell
+    unordered_map<uint64_t, pair<int, int>> cellRuns;
+    cellRuns.reserve(cellIndex.size());
+    for(int i = 0; i < cellIndex.size(); i++){
+        if(i == 0 || cellIndex[i].first != cellIndex[i-1].first){
+            cellRuns[cellIndex[i].first] = {i, i};
+        }
+        cellRuns[cellIndex[i].first].second = i + 1;
+    }
+
+
+    /*
+    Merging process: Using the grid, identify like colors and merge them into one entry
+    */
+    
+
+    for(int i = 0; i < recordedColors.size(); i++){
+        int x = recordedColors[i].r;
+        int y = recordedColors[i].g;
+        int z = recordedColors[i].b;
+        int w = recordedColors[i].a;
+
+        int bx = x / hashWidth;
+        int by = y / hashWidth;
+        int bz = z / hashWidth;
+        int bw = w / hashWidth;
+
+        //How many pixels for all alike colors
+        int64_t totalAlike = recordedColors[i].count;
+        //
+        bool merge = false;
+        //Of the group of similar colors, which is the most common
+        int dominantIndex = i;
+
+        for(int n = 0; n < 81; n++){
+            int cx = bx + n % 3 - 1;
+            int cy = by + n / 3 % 3 - 1;
+            int cz = bz + n / 9 % 3 - 1;
+            int cw = bw + n / 27 - 1;
+            if(cx < 0 || cy < 0 || cz < 0 || cw < 0 || cx >= side || cy >= side || cz >= side || cw >= side){
+                continue;
+            }
+            auto run = cellRuns.find(gridCell(cx, cy, cz, cw, side));
+            if(run == cellRuns.end()){
+                continue;
+            }
+
+            for(int k = run->second.first; k < run->second.second; k++){
+                int colorIndex = cellIndex[k].second;
+                //Check if there is a valid color nearby
+                if(ColorDistance({(unsigned char)x, (unsigned char)y, (unsigned char)z, (unsigned char)w}, {recordedColors[colorIndex].r, recordedColors[colorIndex].g, recordedColors[colorIndex].b, recordedColors[colorIndex].a}) < hashWidth && i != colorIndex && recordedColors[colorIndex].count > 0){
+                    merge = true;
+                    //If this color is more common record so
+                    //Pixels are moved once: a displaced dominant (other than this color) hands its count over right away
+                    if(recordedColors[colorIndex].count > recordedColors[dominantIndex].count){
+                        if(dominantIndex != i){
+                            recordedColors[dominantIndex].count = 0;
+                        }
+                        dominantIndex = colorIndex;
+                        totalAlike += recordedColors[colorIndex].count;
+                    }
+                    else {
+                        totalAlike += recordedColors[colorIndex].count;
+                        recordedColors[colorIndex].count = 0;
+                    }
+                }
+            }
+        }
+
+        if(merge){
+            if(dominantIndex == i){
+                recordedColors[i].count = (int)totalAlike;
+            }
+            else {
+                recordedColors[dominantIndex].count = (int)totalAlike;
+                recordedColors[i].count = 0;
+            }
+        }
+
+    }
+
+    //Drop every merged entry in one pass
+    int merged = recordedColors.size();
+    recordedColors.erase(remove_if(recordedColors.begin(), recordedColors.end(), [](const ColorRecord &c){
+        return c.count == 0;
+    }), recordedColors.end());
+    merged -= recordedColors.size();
+
+    if(ctx.options.verbose)
+        cout << "Merged " << merged << " colors, total colors: " << recordedColors.size() << endl;
+}
+
+/*
+Median cut: starting from one box holding every color, repeatedly split the box with the largest
+spread (pixel count times squared channel range) at the pixel-weighted median of its widest channel
+Each split is linear in the colors of the box, so the palette costs O(unique colors * log numColors)
+and only the records themselves are kept in memory
+Every box becomes one palette entry at its pixel-weighted mean color
+*/
+typedef struct ColorBox {
+    int begin;
+    int end;
+    long long count;
+    int channel;
+    int range;
+} ColorBox;
+
+inline int channelValue(const ColorRecord &c, int channel){
+    return channel == 0 ? c.r : (channel == 1 ? c.g : (channel == 2 ? c.b : c.a));
+}
+
+void measureBox(vector<ColorRecord> &colors, ColorBox &box){
+    int lo[4] = {255, 255, 255, 255};
+    int hi[4] = {0, 0, 0, 0};
+    box.count = 0;
+    for(int i = box.begin; i < box.end; i++){
+        for(int ch = 0; ch < 4; ch++){
+            int v = channelValue(colors[i], ch);
+            lo[ch] = min(lo[ch], v);
+            hi[ch] = max(hi[ch], v);
+        }
+        box.count += colors[i].count;
+    }
+    box.channel = 0;
+    box.range = -1;
+    for(int ch = 0; ch < 4; ch++){
+        if(hi[ch] - lo[ch] > box.range){
+            box.range = hi[ch] - lo[ch];
+            box.channel = ch;
+        }
+    }
+}
+
+bool compareBoxSpread(const ColorBox &a, const ColorBox &b){
+    return (double)a.count * a.range * a.range < (double)b.count * b.range * b.range;
+}
+
+void medianCut(ConvertContext &ctx, vector<ColorRecord> &recordedColors){
+    int numColors = ctx.options.numColors;
+    if((int)recordedColors.size() <= numColors || numColors <= 0){
+        return;
+    }
+
+    vector<ColorBox> boxes;
+    ColorBox all = {0, (int)recordedColors.size(), 0, 0, 0};
+    measureBox(recordedColors, all);
+    boxes.push_back(all);
+
+    while(boxes.size() < numColors){
+        //Boxes are kept as a max heap on their spread
+        pop_heap(boxes.begin(), boxes.end(), compareBoxSpread);
+        ColorBox box = boxes.back();
+        if(box.range <= 0){
+            //The widest box left is a single color, nothing more to split
+            push_heap(boxes.begin(), boxes.end(), compareBoxSpread);
+            break;
+        }
+        boxes.pop_back();
+
+        //Weighted median of the widest channel through a 256 bucket count
+        long long histogram[256] = {0};
+        for(int i = box.begin; i < box.end; i++){
+            histogram[channelValue(recordedColors[i], box.channel)] += recordedColors[i].count;
+        }
+        int median = 0;
+        long long seen = 0;
+        while(median < 255 && (seen + histogram[median]) * 2 < box.count){
+            seen += histogram[median];
+            median++;
+        }
+        auto split = partition(recordedColors.begin() + box.begin, recordedColors.begin() + box.end, [&](const ColorRecord &c){
+            return channelValue(c, box.channel) <= median;
+        });
+        int mid = split - recordedColors.begin();
+        if(mid == box.end){
+            //The median landed on the largest value, move that value to the upper half instead
+            split = partition(recordedColors.begin() + box.begin, recordedColors.begin() + box.end, [&](const ColorRecord &c){
+                return channelValue(c, box.channel) < median;
+            });
+            mid = split - recordedColors.begin();
+        }
+
+        ColorBox lower = {box.begin, mid, 0, 0, 0};
+        ColorBox upper = {mid, box.end, 0, 0, 0};
+        measureBox(recordedColors, lower);
+        measureBox(recordedColors, upper);
+        boxes.push_back(lower);
+        push_heap(boxes.begin(), boxes.end(), compareBoxSpread);
+        boxes.push_back(upper);
+        push_heap(boxes.begin(), boxes.end(), compareBoxSpread);
+    }
+
+    vector<ColorRecord> palette;
+    for(int b = 0; b < boxes.size(); b++){
+        double sum[4] = {0, 0, 0, 0};
+        for(int i = boxes[b].begin; i < boxes[b].end; i++){
+            for(int ch = 0; ch < 4; ch++){
+                sum[ch] += (double)channelValue(recordedColors[i], ch) * recordedColors[i].count;
+            }
+        }
+        double total = max(1.0, (double)boxes[b].count);
+        ColorRecord c;
+        c.r = (unsigned char)lround(sum[0] / total);
+        c.g = (unsigned char)lround(sum[1] / total);
+        c.b = (unsigned char)lround(sum[2] / total);
+        c.a = (unsigned char)lround(sum[3] / total);
+        c.count = (int)boxes[b].count;
+        palette.push_back(c);
+    }
+    recordedColors.swap(palette);
+
+    if(ctx.options.verbose)
+        cout << "Median cut into " << recordedColors.size() << " colors" << endl;
+}
+
+/*
+Lloyd's k-means over the unique colors of the image, weighted by their pixel counts
+Starts from the palette the quantizer picked and stops once no entry moves (after rounding)
+or after kmeansIterations rounds
+Assignment uses the vectorized palette search; each thread sums its share of colors
+into private accumulators that are added together at the end of the round
+*/
+void refinePalette(ConvertContext &ctx, const ColorHistogram &colorData, vector<ColorRecord> &palette){
+    if(palette.empty()){
+        return;
+    }
+    vector<ColorRecord> samples;
+    colorData.toRecords(samples);
+    //Fully transparent pixels get the transparent label, keep them from pulling an entry
+    samples.erase(remove_if(samples.begin(), samples.end(), [](const ColorRecord &c){
+        return c.a == 0;
+    }), samples.end());
+
+    int k = palette.size();
+    int threads = stageThreads(ctx, samples.size() * k, 1 << 20);
+    int iteration = 0;
+    bool moved = true;
+    while(moved && iteration < ctx.options.kmeansIterations){
+        iteration++;
+        PaletteMatcher matcher(palette);
+
+        //Per thread: r, g, b, a sums and pixel count of every entry
+        vector<vector<double>> sums(threads, vector<double>((size_t)k * 5, 0.0));
+        parallelFor(samples.size(), threads, [&](int begin, int end, int t){
+            double *acc = sums[t].data();
+            for(int i = begin; i < end; i++){
+                const ColorRecord &c = samples[i];
+                double *entry = acc + (size_t)matcher.nearestIndex({c.r, c.g, c.b, c.a}) * 5;
+                entry[0] += (double)c.r * c.count;
+                entry[1] += (double)c.g * c.count;
+                entry[2] += (double)c.b * c.count;
+                entry[3] += (double)c.a * c.count;
+                entry[4] += c.count;
+            }
+        });
+        for(int t = 1; t < threads; t++){
+            for(size_t j = 0; j < sums[0].size(); j++){
+                sums[0][j] += sums[t][j];
+            }
+        }
+
+        moved = false;
+        for(int j = 0; j < k; j++){
+            const double *entry = &sums[0][(size_t)j * 5];
+            //An entry nothing maps to keeps its color
+            if(entry[4] <= 0){
+                palette[j].count = 0;
+                continue;
+            }
+            ColorRecord c;
+            c.r = (unsigned char)lround(entry[0] / entry[4]);
+            c.g = (unsigned char)lround(entry[1] / entry[4]);
+            c.b = (unsigned char)lround(entry[2] / entry[4]);
+            c.a = (unsigned char)lround(entry[3] / entry[4]);
+            c.count = (int)entry[4];
+            if(c.r != palette[j].r || c.g != palette[j].g || c.b != palette[j].b || c.a != palette[j].a){
+                moved = true;
+            }
+            palette[j] = c;
+        }
+    }
+
+    std::sort(palette.begin(), palette.end(), compColor);
+
+    if(ctx.options.verbose)
+        cout << "Refined palette with " << iteration << " k-means iterations" << (moved ? "" : " (converged)") << endl;
+}
+
+/*
+Counts the colors of every stride-th pixel of every stride-th row, starting at (offset, offset)
+Each thread counts a band of rows into its own table, the tables are merged afterwards
+*/
+ColorHistogram countColors(ConvertContext &ctx, const RgbaView &view, int stride, int offset){
+    int rows = (view.height - offset + stride - 1) / stride;
+    int columns = (view.width - offset + stride - 1) / stride;
+    int threads = stageThreads(ctx, (size_t)rows * columns, 1 << 18);
+    vector<ColorHistogram> partial(threads);
+    parallelFor(rows, threads, [&](int begin, int end, int t){
+        ColorHistogram &table = partial[t];
+        for(int j = begin; j < end; j++){
+            const Color *row = view.row(offset + j * stride);
+            for(int i = offset; i < view.width; i += stride){
+                table.add(pixelKey(row[i]));
+            }
+        }
+    });
+    for(int t = 1; t < threads; t++){
+        partial[0].merge(partial[t]);
+    }
+    return std::move(partial[0]);
+}
+
+/*
+Picks the palette from the counted colors into recordedColors
+Returns true when the colors fit in the palette as they are and were kept exactly
+*/
+bool choosePalette(ConvertContext &ctx, const ColorHistogram &colorData, vector<ColorRecord> &recordedColors, int numColors){
+    recordedColors.clear();
+    colorData.toRecords(recordedColors);
+    //Transparent pixels never take a palette entry
+    recordedColors.erase(remove_if(recordedColors.begin(), recordedColors.end(), [](const ColorRecord &c){
+        return c.a == 0;
+    }), recordedColors.end());
+
+    /*
+    Logos, flags and palette PNGs often have no more colors than the palette allows
+    Their colors are kept exactly, which skips the quantizer and the closest color search
+    */
+    bool exactColors = (int)recordedColors.size() <= numColors;
+    if(exactColors){
+        std::sort(recordedColors.begin(), recordedColors.end(), compColor);
+        if(ctx.options.verbose)
+            cout << "Image has only " << recordedColors.size() << " colors, keeping them all" << endl;
+        return true;
+    }
+
+    if(ctx.options.quantizer == QUANTIZER_MEDIAN_CUT){
+        medianCut(ctx, recordedColors);
+    }
+    else {
+        mergeSimilarColors(ctx, recordedColors);
+    }
+    
+    std::sort(recordedColors.begin(), recordedColors.end(), compColor);
+    
+    if((int)recordedColors.size() > numColors){
+        recordedColors.erase(recordedColors.begin() + numColors, recordedColors.end());
+    }
+
+    if(ctx.options.verbose)
+        cout << "Reduced to top " << recordedColors.size() << " colors" << endl;
+
+    if(ctx.options.kmeansIterations > 0){
+        refinePalette(ctx, colorData, recordedColors);
+    }
+    return false;
+}
+
+//Average distance from the counted opaque pixels to their closest palette color
+float paletteError(ConvertContext &ctx, const PaletteMatcher &matcher, const ColorHistogram &colorData){
+    if(matcher.size == 0){
+        return 0;
+    }
+    int threads = stageThreads(ctx, colorData.size() * matcher.size, 1 << 20);
+    vector<double> error(threads, 0.0);
+    vector<double> pixels(threads, 0.0);
+    parallelFor(colorData.keys.size(), threads, [&](int begin, int end, int t){
+        for(int k = begin; k < end; k++){
+            Color col = unpackColor(colorData.keys[k]);
+            if(colorData.counts[k] == 0 || col.a == 0){
+                continue;
+            }
+            error[t] += (double)ColorDistance(col, matcher.nearest(col)) * colorData.counts[k];
+            pixels[t] += colorData.counts[k];
+        }
+    });
+    for(int t = 1; t < threads; t++){
+        error[0] += error[t];
+        pixels[0] += pixels[t];
+    }
+    return pixels[0] > 0 ? (float)(error[0] / pixels[0]) : 0.0f;
+}
+
+//Entries of a fixed palette that get a label, in order
+void fixedPaletteEntries(const vector<ColorRecord> &palette, vector<ColorRecord> &recordedColors){
+    recordedColors.clear();
+    for(int i = 0; i < palette.size() && recordedColors.size() < maxNumColors; i++){
+        ColorRecord c = palette[i];
+        //Transparent pixels have their own label, a transparent entry would never be used
+        if(c.a != 0){
+            c.count = 0;
+            recordedColors.push_back(c);
+        }
+    }
+}
+
+//Whether a prebuilt matcher was built from exactly these palette entries
+bool matcherFits(const PaletteMatcher &matcher, const vector<ColorRecord> &recordedColors){
+    if(matcher.size != recordedColors.size()){
+        return false;
+    }
+    for(int i = 0; i < matcher.size; i++){
+        Color c = matcher.colors[i];
+        if(c.r != recordedColors[i].r || c.g != recordedColors[i].g || c.b != recordedColors[i].b || c.a != recordedColors[i].a){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Picks the palette into recordedColors, either the fixed one or one chosen from the counted colors of the image
+colorData and stride are left as the palette was picked from (empty and 1 for a fixed palette)
+Returns true when the colors of the image were kept exactly
+*/
+bool pickPalette(ConvertContext &ctx, const RgbaView &view, vector<ColorRecord> &recordedColors, ColorHistogram &colorData, int &stride){
+    int numColors = min(max(ctx.options.numColors, 1), maxNumColors);
+    stride = 1;
+    //A fixed palette (shared by a set of images) skips counting and quantizing, pixels go straight to the remap
+    if(!ctx.options.palette.empty()){
+        fixedPaletteEntries(ctx.options.palette, recordedColors);
+        if(ctx.options.verbose)
+            cout << "Using fixed palette of " << recordedColors.size() << " colors" << endl;
+        return false;
+    }
+
+    //Get color map
+    stride = ctx.options.sampleStride;
+    if(stride <= 0){
+        stride = max(1, (int)sqrt((double)view.width * view.height / autoSamplePixels));
+    }
+    stride = max(1, min(stride, min(view.width, view.height)));
+    colorData = countColors(ctx, view, stride, 0);
+
+    //
+    if(ctx.options.verbose)
+        cout << "Total colors: " << colorData.size() << (stride > 1 ? " (sampled every " + to_string(stride) + " pixels)" : "") << endl;
+
+    bool exactColors = choosePalette(ctx, colorData, recordedColors, numColors);
+
+    /*
+    A sampled palette is checked against a second sample taken between the first one's pixels
+    If it fits those pixels much worse than the ones it was built from, the sample missed
+    some of the image and the palette is rebuilt from one twice as dense
+    */
+    while(stride > 1 && ctx.options.sampleErrorBound > 0){
+        ColorHistogram check = countColors(ctx, view, stride, stride / 2);
+        PaletteMatcher matcher(recordedColors);
+        float fitError = paletteError(ctx, matcher, colorData);
+        float checkError = paletteError(ctx, matcher, check);
+        if(ctx.options.verbose)
+            cout << "Sampled palette error " << fitError << ", on check sample " << checkError << endl;
+        if(checkError - fitError <= ctx.options.sampleErrorBound){
+            break;
+        }
+        stride /= 2;
+        colorData = countColors(ctx, view, stride, 0);
+        if(ctx.options.verbose)
+            cout << "Total colors: " << colorData.size() << " (sampled every " << stride << " pixels)" << endl;
+        exactColors = choosePalette(ctx, colorData, recordedColors, numColors);
+    }
+    return exactColors;
+}
+
+void reduceColors(ConvertContext &ctx, Image &image, vector<ColorRecord> &recordedColors, LabelImage &labels){
+    RgbaView view = viewImage(image);
+    int threads = stageThreads(ctx, (size_t)view.width * view.height, 1 << 18);
+
+    bool fixedPalette = !ctx.options.palette.empty();
+    int stride = 1;
+    ColorHistogram colorData;
+    bool exactColors = pickPalette(ctx, view, recordedColors, colorData, stride);
+
+    /*
+    for(int i = 0; i < recordedColors.size(); i++){
+        if(recordedColors[i].r == 0 && recordedColors[i].g == 0 && recordedColors[i].b == 0 && recordedColors[i].a > 0){
+            recordedColors[i].r = 1;
+        }
+    }
+    */
+    //Label the image with the reduced palette.
+    //Fully transparent pixels get the extra transparent label after the palette entries
+    labels.width = view.width;
+    labels.height = view.height;
+    labels.transparentLabel = recordedColors.size();
+    labels.palette.clear();
+    for(int i = 0; i < recordedColors.size(); i++){
+        labels.palette.push_back({recordedColors[i].r, recordedColors[i].g, recordedColors[i].b, recordedColors[i].a});
+    }
+    labels.palette.push_back({0, 0, 0, 0});
+    labels.labels.resize((size_t)view.width * view.height);
+
+    //Whether every pixel color has a histogram slot to memoize its match in
+    bool countedAll = !fixedPalette && stride == 1;
+    vector<uint16_t> remap(colorData.keys.size());
+    if(exactColors && countedAll){
+        //Every color is its own palette entry
+        for(int i = 0; i < recordedColors.size(); i++){
+            remap[colorData.slotFor(packColor(labels.palette[i]))] = i;
+        }
+        remap[colorData.slotFor(0)] = labels.transparentLabel;
+    }
+    else {
+        //Duplicate entries (possible after median cut or k-means) share the label of the first one,
+        //so later stages can compare labels directly
+        vector<uint16_t> entryLabel(labels.palette.size());
+        unordered_map<uint32_t, uint16_t> firstEntry;
+        for(int i = 0; i < labels.palette.size(); i++){
+            entryLabel[i] = firstEntry.emplace(packColor(labels.palette[i]), i).first->second;
+        }
+
+        //A fixed palette may come with its matcher (and lookup table) already built for a whole batch
+        const PaletteMatcher *shared = fixedPalette ? ctx.options.paletteMatcher.get() : nullptr;
+        if(shared != nullptr && !matcherFits(*shared, recordedColors)){
+            shared = nullptr;
+        }
+        PaletteMatcher ownMatcher(shared != nullptr ? vector<ColorRecord>() : recordedColors);
+        const PaletteMatcher &matcher = shared != nullptr ? *shared : ownMatcher;
+        if(ctx.options.verbose && shared != nullptr)
+            cout << "Using the prebuilt palette matcher" << endl;
+        if(ctx.options.verbose)
+            cout << "Nearest palette color kernel: " << paletteKernelName() << endl;
+        if(!countedAll){
+            /*
+            Most colors of a sampled image (or any image with a fixed palette) were never counted,
+            so every pixel is matched on its own
+            Runs of one color along a row reuse the previous match
+            */
+            if(shared == nullptr){
+                usePaletteEngine(ctx, ownMatcher, (size_t)view.width * view.height);
+            }
+            parallelFor(view.height, threads, [&](int begin, int end, int /*t*/){
+                for(int j = begin; j < end; j++){
+                    const Color *row = view.row(j);
+                    uint16_t *labelRow = &labels.labels[(size_t)j * view.width];
+                    uint32_t lastKey = 0;
+                    uint16_t lastLabel = labels.transparentLabel;
+                    for(int i = 0; i < view.width; i++){
+                        uint32_t key = pixelKey(row[i]);
+                        if(key != lastKey){
+                            lastKey = key;
+                            lastLabel = (key == 0 || matcher.size == 0) ? labels.transparentLabel : entryLabel[matcher.nearestIndex(row[i])];
+                        }
+                        labelRow[i] = lastLabel;
+                    }
+                }
+            });
+            return;
+        }
+
+        /*
+        Every pixel of the same color maps to the same palette entry, so the closest palette color
+        is found once per histogram slot and the pixels are then labeled with a table lookup
+        */
+        usePaletteEngine(ctx, ownMatcher, colorData.size());
+        int remapThreads = stageThreads(ctx, colorData.size() * recordedColors.size(), 1 << 20);
+        parallelFor(colorData.keys.size(), remapThreads, [&](int begin, int end, int /*t*/){
+            for(int k = begin; k < end; k++){
+                if(colorData.counts[k] == 0){
+                    continue;
+                }
+                Color col = unpackColor(colorData.keys[k]);
+                if(col.a == 0 || matcher.size == 0){
+                    remap[k] = labels.transparentLabel;
+                }
+                else{
+                    remap[k] = entryLabel[matcher.nearestIndex(col)];
+                }
+            }
+        });
+    }
+
+    parallelFor(view.height, threads, [&](int begin, int end, int /*t*/){
+        for(int j = begin; j < end; j++){
+            const Color *row = view.row(j);
+            uint16_t *labelRow = &labels.labels[(size_t)j * view.width];
+            for(int i = 0; i < view.width; i++){
+                labelRow[i] = remap[colorData.slotFor(pixelKey(row[i]))];
+            }
+        }
+    });
+    
+}
+
+void paintLabels(const LabelImage &labels, Image &image){
+    RgbaView view = viewImage(image);
+    for(int j = 0; j < labels.height; j++){
+        for(int i = 0; i < labels.width; i++){
+            view.at(i, j) = labels.palette[labels.labels[(size_t)j * labels.width + i]];
+        }
+    }
+}
+
+
+
+//Regions with fewer border pixels than this are dropped
+const int minRegionBorder = 10;
+
+//Both tracers take the border pixels of a region in column major order
+void sortBorderPixels(Region *r){
+    std::sort(r->borderPixels.begin(), r->borderPixels.end(), [](const Coordinate &a, const Coordinate &b){
+        return a.x != b.x ? a.x < b.x : a.y < b.y;
+    });
+}
+
+/*
+One round of absorbSmallRegions, returns how many specks were merged
+left counts the specks that could not be placed, because the specks they join only lead back to themselves
+*/
+int mergeSpecks(ConvertContext &ctx, LabelImage &labels, int &left){
+    int width = labels.width;
+    int height = labels.height;
+    int threads = stageThreads(ctx, (size_t)width * height, 1 << 18);
+    ComponentImage components;
+    labelComponents(labels, components, threads);
+    const vector<ComponentStats> &stats = components.stats;
+    auto small = [&](int32_t c){
+        return stats[c].borderPixels < minRegionBorder;
+    };
+    auto before = [&](int32_t a, int32_t b){
+        return stats[a].firstX != stats[b].firstX ? stats[a].firstX < stats[b].firstX : stats[a].firstY < stats[b].firstY;
+    };
+
+    //Component each speck joins, -1 for the ones that are kept
+    vector<int32_t> target(stats.size(), -1);
+    int absorbed = 0;
+    //Pixel sides shared with each neighboring component, a speck only has a few neighbors
+    vector<pair<int32_t, int>> shared;
+    for(int32_t c = 0; c < stats.size(); c++){
+        const ComponentStats &s = stats[c];
+        if(!small(c)){
+            continue;
+        }
+        shared.clear();
+        for(int y = s.minY; y <= s.maxY; y++){
+            for(int x = s.minX; x <= s.maxX; x++){
+                if(components.ids[(size_t)y * width + x] != c){
+                    continue;
+                }
+                for(int side = 0; side < 4; side++){
+                    int nx = x + (side == 1) - (side == 3);
+                    int ny = y + (side == 2) - (side == 0);
+                    if(nx < 0 || ny < 0 || nx >= width || ny >= height){
+                        continue;
+                    }
+                    int32_t n = components.ids[(size_t)ny * width + nx];
+                    if(n == c){
+                        continue;
+                    }
+                    int k = 0;
+                    while(k < shared.size() && shared[k].first != n){
+                        k++;
+                    }
+                    if(k == shared.size()){
+                        shared.push_back({n, 0});
+                    }
+                    shared[k].second++;
+                }
+            }
+        }
+        int best = -1;
+        for(int k = 0; k < shared.size(); k++){
+            if(best < 0){
+                best = k;
+                continue;
+            }
+            int32_t a = shared[k].first;
+            int32_t b = shared[best].first;
+            if(small(a) != small(b)){
+                if(!small(a)){
+                    best = k;
+                }
+            }
+            else if(shared[k].second != shared[best].second ? shared[k].second > shared[best].second : before(a, b)){
+                best = k;
+            }
+        }
+        if(best >= 0){
+            target[c] = shared[best].first;
+        }
+    }
+
+    /*
+    Follow chains of specks to a kept component, remembering where each speck ends up so every chain is walked once
+    -1 is not known yet, -2 is a speck without a kept component at the end of its chain, -3 is on the chain being walked
+    */
+    vector<int32_t> joins(stats.size(), -1);
+    vector<int32_t> chain;
+    left = 0;
+    for(int32_t c = 0; c < stats.size(); c++){
+        if(!small(c)){
+            continue;
+        }
+        chain.clear();
+        int32_t t = c;
+        while(small(t) && target[t] >= 0 && joins[t] == -1){
+            joins[t] = -3;
+            chain.push_back(t);
+            t = target[t];
+        }
+        int32_t end = !small(t) ? t : (joins[t] >= 0 ? joins[t] : -2);
+        for(int k = 0; k < chain.size(); k++){
+            joins[chain[k]] = end;
+        }
+        if(joins[c] == -1){
+            joins[c] = end;
+        }
+        t = joins[c];
+        if(t < 0){
+            left++;
+            continue;
+        }
+        absorbed++;
+        if(stats[t].label == stats[c].label){
+            //Joins through a speck that takes the same label as its own, nothing to relabel
+            continue;
+        }
+        const ComponentStats &s = stats[c];
+        for(int y = s.minY; y <= s.maxY; y++){
+            for(int x = s.minX; x <= s.maxX; x++){
+                size_t p = (size_t)y * width + x;
+                if(components.ids[p] == c){
+                    labels.labels[p] = stats[t].label;
+                }
+            }
+        }
+    }
+    return absorbed;
+}
+
+/*
+Regions are kept as holes of the regions around them, so areas too small to become a region
+(fewer than minRegionBorder border pixels) can't be left out: they would show as gaps
+Each one takes the label of the neighboring area it shares the most pixel sides with,
+preferring areas large enough to keep and then the first in column major order
+Specks only touching other specks follow the speck they join
+Specks whose chains loop back get another round, once their other neighbors have been merged
+*/
+void absorbSmallRegions(ConvertContext &ctx, LabelImage &labels){
+    int absorbed = 0;
+    int left = 0;
+    int merged;
+    do {
+        merged = mergeSpecks(ctx, labels, left);
+        absorbed += merged;
+    } while(left > 0 && merged > 0);
+    if(ctx.options.verbose)
+        cout << "Merged " << absorbed << " small areas into their neighbors" << endl;
+}
+
+/*
+Transparent areas are never filled. The crack tracer leaves them out of the regions around it as holes,
+the walk tracer keeps the enclosed ones as regions to cut them out with the mask
+*/
+bool dropTransparent(ConvertContext &ctx, bool touchesEdge){
+    return ctx.options.tracer == TRACER_CRACK || touchesEdge;
+}
+
+/*
+Union-find region engine
+Areas refineBorders would drop (too few border pixels, transparent areas)
+are skipped by their stats, before any of their border pixels are collected
+The kept regions are listed in the order the flood fill finds them, and the working copy of the labels
+is left as the fill leaves it (every pixel cleared), so both engines produce the same output
+*/
+void findComponentRegions(ConvertContext &ctx, LabelImage &labels, vector<uint16_t> &refined, vector<Region*> &regions){
+    int width = labels.width;
+    int height = labels.height;
+    int threads = stageThreads(ctx, (size_t)width * height, 1 << 18);
+    ComponentImage components;
+    labelComponents(labels, components, threads);
+
+    vector<int32_t> kept;
+    for(int32_t c = 0; c < components.stats.size(); c++){
+        const ComponentStats &s = components.stats[c];
+        bool touchesEdge = s.minX == 0 || s.minY == 0 || s.maxX == width-1 || s.maxY == height-1;
+        if(s.borderPixels < minRegionBorder || (s.label == labels.transparentLabel && dropTransparent(ctx, touchesEdge))){
+            continue;
+        }
+        kept.push_back(c);
+    }
+    std::sort(kept.begin(), kept.end(), [&](int32_t a, int32_t b){
+        const ComponentStats &sa = components.stats[a];
+        const ComponentStats &sb = components.stats[b];
+        return sa.firstX != sb.firstX ? sa.firstX < sb.firstX : sa.firstY < sb.firstY;
+    });
+
+    vector<int32_t> regionOf(components.stats.size(), -1);
+    vector<vector<Coordinate>> borders(kept.size());
+    for(int k = 0; k < kept.size(); k++){
+        regionOf[kept[k]] = k;
+        borders[k].reserve(components.stats[kept[k]].borderPixels);
+    }
+
+    //Each thread gathers the border pixels of its rows, they are sorted per region afterwards anyway
+    typedef struct BorderPixel {
+        int32_t region;
+        Coordinate pixel;
+    } BorderPixel;
+    vector<vector<BorderPixel>> partial(threads);
+    const uint16_t *label = labels.labels.data();
+    parallelFor(height, threads, [&](int begin, int end, int t){
+        for(int y = begin; y < end; y++){
+            for(int x = 0; x < width; x++){
+                size_t p = (size_t)y * width + x;
+                refined[p] |= clearedLabel;
+                int32_t region = regionOf[components.ids[p]];
+                if(region < 0){
+                    continue;
+                }
+                if(x == 0 || x == width-1 || y == 0 || y == height-1 ||
+                   label[p-1] != label[p] || label[p+1] != label[p] || label[p-width] != label[p] || label[p+width] != label[p]){
+                    partial[t].push_back({region, {x, y}});
+                }
+            }
+        }
+    });
+    for(int t = 0; t < threads; t++){
+        for(int k = 0; k < partial[t].size(); k++){
+            borders[partial[t][k].region].push_back(partial[t][k].pixel);
+        }
+    }
+
+    for(int k = 0; k < kept.size(); k++){
+        Region *r = new Region();
+        r->color = labels.palette[components.stats[kept[k]].label];
+        r->borderPixels.swap(borders[k]);
+        sortBorderPixels(r);
+        regions.push_back(r);
+    }
+}
+
+/*
+Border pixels of a region the walk tracer has not visited yet
+Pixels are bucketed into square cells over the region's bounding box, so the nearest one is found
+by searching rings of cells around the query, not by going through every pixel left
+*/
+typedef struct BorderIndex {
+    //Side of a cell in pixels
+    static const int cellSize = 8;
+    int minX = 0;
+    int minY = 0;
+    int boxWidth = 0;
+    int boxHeight = 0;
+    int cellsX = 0;
+    int cellsY = 0;
+    //One flag per pixel of the bounding box, set while the pixel is left
+    vector<uint8_t> present;
+    //Pixels of cell i are cellPixels[cellStart[i]] to cellPixels[cellStart[i+1]-1], cellLeft[i] of them are left
+    vector<int> cellStart;
+    vector<int> cellLeft;
+    vector<Coordinate> cellPixels;
+    //Pixels in column major order, first() moves through them
+    const vector<Coordinate> &ordered;
+    size_t cursor = 0;
+    size_t left = 0;
+
+    BorderIndex(const vector<Coordinate> &pixels) : ordered(pixels) {
+        if(pixels.empty()){
+            return;
+        }
+        int maxX = pixels[0].x;
+        int maxY = pixels[0].y;
+        minX = maxX;
+        minY = maxY;
+        for(int k = 1; k < pixels.size(); k++){
+            minX = min(minX, pixels[k].x);
+            minY = min(minY, pixels[k].y);
+            maxX = max(maxX, pixels[k].x);
+            maxY = max(maxY, pixels[k].y);
+        }
+        boxWidth = maxX - minX + 1;
+        boxHeight = maxY - minY + 1;
+        cellsX = (boxWidth + cellSize - 1) / cellSize;
+        cellsY = (boxHeight + cellSize - 1) / cellSize;
+        present.assign((size_t)boxWidth * boxHeight, 0);
+        cellLeft.assign((size_t)cellsX * cellsY, 0);
+        for(int k = 0; k < pixels.size(); k++){
+            uint8_t &flag = present[(size_t)(pixels[k].y - minY) * boxWidth + pixels[k].x - minX];
+            if(!flag){
+                flag = 1;
+                cellLeft[cellOf(pixels[k].x, pixels[k].y)]++;
+                left++;
+            }
+        }
+        cellStart.assign(cellLeft.size() + 1, 0);
+        for(int i = 0; i < cellLeft.size(); i++){
+            cellStart[i + 1] = cellStart[i] + cellLeft[i];
+        }
+        //Pixels keep their column major order within each cell
+        cellPixels.resize(left);
+        vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+        for(int k = 0; k < pixels.size(); k++){
+            if(k > 0 && pixels[k].x == pixels[k-1].x && pixels[k].y == pixels[k-1].y){
+                continue;
+            }
+            cellPixels[fill[cellOf(pixels[k].x, pixels[k].y)]++] = pixels[k];
+        }
+    }
+
+    int cellOf(int x, int y) const {
+        return ((y - minY) / cellSize) * cellsX + (x - minX) / cellSize;
+    }
+
+    size_t size() const {
+        return left;
+    }
+
+    bool contains(int x, int y) const {
+        if(x < minX || y < minY || x >= minX + boxWidth || y >= minY + boxHeight){
+            return false;
+        }
+        return present[(size_t)(y - minY) * boxWidth + x - minX];
+    }
+
+    void erase(Coordinate c){
+        if(!contains(c.x, c.y)){
+            return;
+        }
+        present[(size_t)(c.y - minY) * boxWidth + c.x - minX] = 0;
+        cellLeft[cellOf(c.x, c.y)]--;
+        left--;
+    }
+
+    //First pixel left in column major order, only valid while size() > 0
+    Coordinate first(){
+        while(!contains(ordered[cursor].x, ordered[cursor].y)){
+            cursor++;
+        }
+        return ordered[cursor];
+    }
+
+    /*
+    Closest pixel left to from (euclidean), the first in column major order on ties
+    Rings of cells are searched outwards until every cell further out is known to be too far
+    Returns false when no pixel is left
+    */
+    bool nearest(Coordinate from, Coordinate &found) const {
+        if(left == 0){
+            return false;
+        }
+        int fromX = min(max(from.x - minX, 0), boxWidth - 1) / cellSize;
+        int fromY = min(max(from.y - minY, 0), boxHeight - 1) / cellSize;
+        long long best = -1;
+        int rings = max(max(fromX, cellsX - 1 - fromX), max(fromY, cellsY - 1 - fromY));
+        for(int ring = 0; ring <= rings; ring++){
+            for(int cy = fromY - ring; cy <= fromY + ring; cy++){
+                if(cy < 0 || cy >= cellsY){
+                    continue;
+                }
+                bool edgeRow = cy == fromY - ring || cy == fromY + ring;
+                for(int cx = fromX - ring; cx <= fromX + ring; cx += edgeRow ? 1 : 2 * ring){
+                    if(cx >= 0 && cx < cellsX && cellLeft[cy * cellsX + cx] > 0){
+                        int cell = cy * cellsX + cx;
+                        for(int k = cellStart[cell]; k < cellStart[cell + 1]; k++){
+                            Coordinate c = cellPixels[k];
+                            if(!contains(c.x, c.y)){
+                                continue;
+                            }
+                            long long dx = c.x - from.x;
+                            long long dy = c.y - from.y;
+                            long long d = dx * dx + dy * dy;
+                            if(best < 0 || d < best || (d == best && (c.x < found.x || (c.x == found.x && c.y < found.y)))){
+                                best = d;
+                                found = c;
+                            }
+                        }
+                    }
+                }
+            }
+            //Pixels in the next ring are at least this far from any point of the query's cell
+            long long reach = (long long)ring * cellSize;
+            if(best >= 0 && best <= reach * reach){
+                break;
+            }
+        }
+        return true;
+    }
+} BorderIndex;
+
+/*
+Walk tracer: follows the border pixels of a region from neighbor to neighbor, preferring straight neighbors,
+and jumps to the nearest unmatched pixel (looked up in a BorderIndex) when it gets stuck
+Loops run through pixel centers and may come out open or cut short on ragged borders
+*/
+void walkLoops(ConvertContext &ctx, LabelImage &labels, vector<uint16_t> &refined, Region *r){
+    int width = labels.width;
+    int height = labels.height;
+    auto labelAt = [&](int x, int y) -> uint16_t & {
+        return refined[(size_t)y * width + x];
+    };
+
+    //Now left with a cluster of unsorted pixels, they must be sorted into loops
+    
+
+    BorderIndex unmatched(r->borderPixels);
+    while(unmatched.size() > 0){
+        
+        Coordinate curr = unmatched.first();
+        Coordinate nxt = curr;
+        uint16_t currLabel = labelAt(curr.x, curr.y);
+        
+        unmatched.erase(curr);
+
+        if(currLabel & clearedLabel){
+            continue;
+        }
+        
+        Loop *loop = new Loop();
+        loop->color = labels.palette[currLabel];
+        loop->pixels.push_back(curr);
+
+        bool start = false;
+        int loopSize = 0;
+        bool closeLoop = false;
+
+        while((!(curr.x == nxt.x && curr.y == nxt.y) || !start) && !closeLoop){
+            loopSize++;
+            start = true;
+
+
+            
+            if(nxt.y - 1 >= 0 && unmatched.contains(nxt.x, nxt.y-1)){
+                nxt.y--;
+                unmatched.erase(nxt);
+            }
+            else if(nxt.x - 1 >= 0 && unmatched.contains(nxt.x-1, nxt.y)){
+                nxt.x--;
+                unmatched.erase(nxt);
+            }
+            else if(nxt.y + 1 < height && unmatched.contains(nxt.x, nxt.y+1)){
+                nxt.y++;
+                unmatched.erase(nxt);
+            }
+            else if(nxt.x + 1  < width && unmatched.contains(nxt.x+1, nxt.y)){
+                nxt.x++;
+                unmatched.erase(nxt);
+            }
+            
+            else if(nxt.x + 1 < width && nxt.y + 1 < height && unmatched.contains(nxt.x+1, nxt.y+1)){
+                nxt.x++;
+                nxt.y++;
+                unmatched.erase(nxt);
+            }
+            else if(nxt.x - 1 >= 0 && nxt.y + 1 < height && unmatched.contains(nxt.x-1, nxt.y+1)){
+                nxt.x--;
+                nxt.y++;
+                unmatched.erase(nxt);
+            }
+            else if(nxt.x + 1 < width && nxt.y - 1 >= 0 && unmatched.contains(nxt.x+1, nxt.y-1)){
+                nxt.x++;
+                nxt.y--;
+                unmatched.erase(nxt);
+            }
+            else if(nxt.x - 1 >= 0 && nxt.y - 1 >= 0 && unmatched.contains(nxt.x-1, nxt.y-1)){
+                nxt.x--;
+                nxt.y--;
+                unmatched.erase(nxt);
+            }
+            else if(abs(nxt.x - curr.x) <= 1 && abs(nxt.y - curr.y) <= 1){
+                nxt.x = curr.x;
+                nxt.y = curr.y;
+            }
+            else {
+
+                /*There are some edge cases where a border may branch off in a way that requires
+                backtracking to continue. By default, this isn't possible as the pixels leading back to the
+                next path have already been covered.
+
+                To address this, perform a search for the nearest pixel and jump to it
+                */
+                float shortestDist = 9999;
+                Coordinate shortestI;
+                shortestI.x = -1;
+                shortestI.y = -1;
+                
+                if(unmatched.nearest(nxt, shortestI)){
+                    shortestDist = Vector2Distance({(float)nxt.x, (float)nxt.y}, {(float)shortestI.x, (float)shortestI.y});
+                }
+                if(shortestI.x >= 0){
+
+                    
+                    if(Vector2Distance({(float)nxt.x, (float)nxt.y}, {(float)curr.x, (float)curr.y}) < shortestDist){
+                        nxt.x = curr.x;
+                        nxt.y = curr.y;
+                    }
+                    else{
+                        nxt.x = shortestI.x;
+                        nxt.y = shortestI.y;
+                        unmatched.erase(nxt);
+                    }
+                    
+                }
+                else if(unmatched.size() == 0){
+                    nxt.x = curr.x;
+                    nxt.y = curr.y;
+                }
+                else {
+                    //cout << "No options for " << +r->color.r << ", " << +r->color.g << ", " << +r->color.b << endl;
+                    //No other options, end the loop
+                    closeLoop = true;
+                }
+
+                
+            }
+            
+            loop->pixels.push_back(nxt);
+
+            if(loopSize > width * height){
+                closeLoop = true;
+                if(ctx.options.verbose)
+                    cout << "Too large, close loop" << endl;
+            }
+        }
+        //loop->pixels.erase(loop->pixels.begin() + loop->pixels.size()-1);
+        loop->length = loop->pixels.size();
+        loop->closed = !closeLoop;
+        
+        r->loops.push_back(loop);
+        //cout << "Added new loop of length: " << loop->length << "; closeLoop = " << closeLoop << endl;
+    }
+}
+
+void refineBorders(ConvertContext &ctx, LabelImage &labels, vector<Region*> &regions, Image *debugImage){
+    int width = labels.width;
+    int height = labels.height;
+
+    if(ctx.options.tracer == TRACER_CRACK){
+        absorbSmallRegions(ctx, labels);
+    }
+
+    /*
+    Working copy of the labels, pixels already taken by a region get the cleared bit
+    Regions never overlap, so the bit also serves as the visited map of every fill
+    */
+    vector<uint16_t> refined = labels.labels;
+    auto labelAt = [&](int x, int y) -> uint16_t & {
+        return refined[(size_t)y * width + x];
+    };
+    //Reused by every region so the fills don't allocate
+    vector<Coordinate> seeds;
+
+    if(ctx.options.regionEngine == REGION_ENGINE_UNION_FIND){
+        findComponentRegions(ctx, labels, refined, regions);
+    }
+    else {
+        for(int i = 0; i < width; i++){
+            for(int j = 0; j < height; j++){
+                uint16_t label = labelAt(i, j);
+                if(label & clearedLabel){
+                    continue;
+                }
+                //Otherwise, create a new region to explore
+                Region *r = new Region();
+            
+                r->color = labels.palette[label];
+            
+
+                bool transparent = label == labels.transparentLabel;
+                bool touchesEdge = false;
+
+                auto sameLabel = [&](int x, int y){
+                    return (labelAt(x, y) & labelMask) == label;
+                };
+
+                /*
+                Flood fill the region to detect its borders and clear the region from future generation
+                Scanline fill: every seed on the stack fills its whole run of the region along the row,
+                then pushes one seed for each run of the region touching it in the rows above and below
+                Runs are always filled whole, so checking the seed is enough to skip an explored run
+                */
+                seeds.clear();
+                seeds.push_back({i, j});
+
+                int q = 0;
+                while(seeds.size() > 0){
+                    Coordinate seed = seeds.back();
+                    seeds.pop_back();
+                    if(labelAt(seed.x, seed.y) & clearedLabel){
+                        continue;
+                    }
+
+                    int y = seed.y;
+                    int left = seed.x;
+                    int right = seed.x;
+                    while(left > 0 && sameLabel(left-1, y)){
+                        left--;
+                    }
+                    while(right < width-1 && sameLabel(right+1, y)){
+                        right++;
+                    }
+                    if(y == 0 || y == height-1 || left == 0 || right == width-1){
+                        touchesEdge = true;
+                    }
+
+                    for(int x = left; x <= right; x++){
+                        q++;
+                        Coordinate curr = {x, y};
+
+                        //A pixel is on the border if it is on the image edge or next to another label
+                        bool isBorderPixel = x == left || x == right;
+                        if(y == 0 || !sameLabel(x, y-1)){
+                            isBorderPixel = true;
+                        }
+                        if(y == height-1 || !sameLabel(x, y+1)){
+                            isBorderPixel = true;
+                        }
+
+                        if(isBorderPixel){
+                            r->borderPixels.push_back(curr);
+                        }
+                        //Mark current pixel as clear
+                        labelAt(x, y) = label | clearedLabel;
+                    }
+
+                    for(int ny = y-1; ny <= y+1; ny += 2){
+                        if(ny < 0 || ny >= height){
+                            continue;
+                        }
+                        for(int x = left; x <= right; x++){
+                            //First pixel of each run in the neighboring row
+                            if(labelAt(x, ny) == label && (x == left || !sameLabel(x-1, ny))){
+                                seeds.push_back({x, ny});
+                            }
+                        }
+                    }
+                }
+
+                sortBorderPixels(r);
+                /*
+                if(q > 4)
+                    cout << "Created region of color: " << +r->color.r << ", " << +r->color.g << ", " << +r->color.b << ", " << +r->color.a << "size: " << q << "; " << i << ", " << j << endl;
+                */
+                if(transparent && dropTransparent(ctx, touchesEdge)){
+                    delete r;
+                    continue;
+                }
+                regions.push_back(r);
+            }
+        }
+    }
+
+    
+    for(int i = regions.size()-1; i >= 0; i--){
+        
+        
+        //Removing irrelevant regions
+        if(regions[i]->borderPixels.size() < minRegionBorder){
+            delete regions[i];
+            regions.erase(regions.begin() + i);
+            continue;
+        }
+        
+        
+        for(int k = 0; k < regions[i]->borderPixels.size(); k++){
+            Coordinate a = regions[i]->borderPixels[k];
+            
+            labelAt(a.x, a.y) &= labelMask;
+            
+        }
+        
+        
+    }
+    if(ctx.options.verbose)
+        cout << "Generated " << regions.size() << " regions" << endl;
+
+
+    if(ctx.options.tracer == TRACER_CRACK){
+        //One visited bit per pixel side, shared by all regions since they never overlap
+        vector<uint8_t> visitedCracks((size_t)width * height, 0);
+        for(int i = 0; i < regions.size(); i++){
+            Region *r = regions[i];
+            uint16_t label = labels.labels[(size_t)r->borderPixels[0].y * width + r->borderPixels[0].x];
+            traceContours(labels, label, r->borderPixels, visitedCracks, r->loops);
+            vector<Coordinate>().swap(r->borderPixels);
+        }
+    }
+    else {
+        for(int i = 0; i < regions.size(); i++){
+            walkLoops(ctx, labels, refined, regions[i]);
+            vector<Coordinate>().swap(regions[i]->borderPixels);
+            //cout << "Region " << i << ": " << regions[i]->loops.size() << " loops" << endl;
+        }
+    }
+    
+
+    //cout << "Defined " << regions.size() << " regions" << endl;
+
+    /*
+    The crack tracer puts the outer boundary first and keeps the holes after it
+    Walk loops are too rough to cut holes with, so only the largest one is kept,
+    standing in for the outer boundary, and the regions inside are painted over it
+    */
+    if(ctx.options.tracer == TRACER_WALK){
+        for(int i = 0; i < regions.size(); i++){
+            int largestLoopIndex = 0;
+            int largestSize = -1;
+            if(regions[i]->loops.size() == 1){
+                continue;
+            }
+            for(int j = 0; j < regions[i]->loops.size(); j++){
+                if(regions[i]->loops[j]->length > largestSize){
+                    largestSize = regions[i]->loops[j]->length;
+                    largestLoopIndex = j;
+                }
+            }
+            Loop *tmp = regions[i]->loops[0];
+            regions[i]->loops[0] = regions[i]->loops[largestLoopIndex];
+            regions[i]->loops[largestLoopIndex] = tmp;
+            for(int j = 1; j < regions[i]->loops.size(); j++){
+                delete regions[i]->loops[j];
+            }
+            regions[i]->loops.erase(regions[i]->loops.begin() + 1, regions[i]->loops.end());
+        }
+
+        if(ctx.options.verbose)
+            cout << "Erased extraneous loops" << endl;
+    }
+
+    /*
+    for(int i = 0; i < regions.size(); i++){
+        cout << regions[i]->loops.size() << ", " << regions[i]->loops[0]->length << endl;
+    }
+    */
+
+    //The visualizer shows the region borders left over in the working copy
+    if(debugImage != nullptr){
+        RgbaView debug = viewImage(*debugImage);
+        for(int j = 0; j < height; j++){
+            for(int i = 0; i < width; i++){
+                uint16_t label = labelAt(i, j);
+                Color c = labels.palette[label & labelMask];
+                if(label & clearedLabel){
+                    c.a = 0;
+                }
+                debug.at(i, j) = c;
+            }
+        }
+    }
+    
+    
+
+}
+
+float polygonLength(vector<Coordinate> &pixels){
+    float len = 0;
+    for(int i = 0; i < pixels.size(); i++){
+        int j = (i+1)%pixels.size();
+        len += Vector2Distance({(float)pixels[i].x, (float)pixels[i].y}, {(float)pixels[j].x, (float)pixels[j].y});
+    }
+    return len;
+}
+//Shoelace Algorithm
+float calculateArea(vector<Coordinate> &pixels){
+    if(pixels.size() == 1){
+        return 1;
+    }
+    float l = 0;
+    float r = 0;
+    for(int i = 0; i < pixels.size(); i++){
+        int j = (i+1) % pixels.size();
+        l += pixels[i].x * pixels[j].y;
+        r += pixels[i].y * pixels[j].x;
+    }
+    
+    
+    float area = abs(l - r) * 0.5f;
+    return area;
+}
+
+float distToLine(Vector2 p1, Vector2 p2, Vector2 p3){
+  float d = Vector2Distance(p1, p2);
+  
+  float u = ((p3.x - p1.x)*(p2.x - p1.x) + (p3.y - p1.y)*(p2.y - p1.y)) / (d*d);
+  
+  
+  float cx = p1.x + u * (p2.x - p1.x);
+  float cy = p1.y + u * (p2.y - p1.y);
+  
+  if(u < 0 || u > 1){
+    float d1 = Vector2Distance({p3.x, p3.y}, {p1.x, p1.y});
+    float d2 = Vector2Distance({p3.x, p3.y}, {p2.x, p2.y});
+    if(d1 < d2){
+      cx = p1.x;
+      cy = p1.y;
+    }
+    else {
+      cx = p2.x;
+      cy = p2.y;
+    }
+  }
+  float distance = Vector2Distance({p3.x, p3.y}, {cx, cy});
+  return distance;
+}
+
+//Open paths (closed = false) keep their end points and aren't measured against a closing segment
+float visvalingam(vector<Coordinate> &pixels, int count, float originalLength, vector<Coordinate> &reference, bool closed){
+
+    //Perform visvalingam algorithm
+    for(int n = 0; n < count; n++){
+        int len = pixels.size();
+        float minArea = 999999;
+        int minIndex = -1;
+        int triangles = closed ? len : len - 2;
+        for(int i = 0; i < triangles; i++){
+            int j = (i+1) % len;
+            int k = (j+1) % len;
+            //(1/2) |x1(y2 − y3) + x2(y3 − y1) + x3(y1 − y2)|
+            Coordinate p1 = pixels[i];
+            Coordinate p2 = pixels[j];
+            Coordinate p3 = pixels[k];
+            float area = 0.5f * abs(p1.x * (p2.y - p3.y) + p2.x * (p3.y - p1.y) + p3.x * (p1.y - p2.y));
+            if(area < minArea || minIndex == -1){
+                minArea = area;
+                minIndex = j;
+            }
+        }
+        if(minIndex > -1){
+            pixels.erase(pixels.begin() + minIndex);
+        }
+        else {
+            break;
+        }
+    }
+
+    //Calculate error:
+
+    float maxDist = 0;
+    for(int i = 0; i < reference.size(); i++){
+        float minDist = -1;
+        int minIndex = -1;
+        Coordinate p = reference[i];
+        
+        int segments = closed || pixels.size() == 1 ? pixels.size() : pixels.size() - 1;
+        for(int c = 0; c < segments; c++){
+            int d = (c+1)%pixels.size();
+
+            float distance = distToLine({(float)pixels[c].x, (float)pixels[c].y}, {(float)pixels[d].x, (float)pixels[d].y}, {(float)p.x, (float)p.y});
+            
+            if(distance < minDist || minIndex == -1){
+                minDist = distance;
+                minIndex = c;
+            }
+            
+        }
+            
+        /*
+        if(minDist > maxDist && minDist < 99999){
+            maxDist = minDist;
+        }
+        */
+       maxDist += minDist;
+        
+    }
+    if(pixels.size() == 1){
+        maxDist = 9999999 * reference.size();
+    }
+
+    //float newLength = polygonLength(pixels);
+    //float newLength = calculateArea(pixels);
+    
+    float error = maxDist / reference.size();
+    
+    return error;
+}
+
+//Drops as many vertices from the loop as it can while it stays within polygonError (on average) of the traced one
+//With pinEnds the loop is an open path whose first and last pixels stay
+//At least minLength vertices are kept (or all of them, for shorter loops)
+void simplifyLoop(ConvertContext &ctx, Loop *loop, bool pinEnds, int minLength){
+    loop->idealLength = loop->length;
+    float originalLength = polygonLength(loop->pixels);
+    float originalArea = calculateArea(loop->pixels);
+    //cout << "area: " << originalArea << endl;
+    float localPolygonError = ctx.options.polygonError;
+    
+    //Uncomment for no simplification:
+    //loop->simplifiedShape.clear();
+    //copy(loop->pixels.begin(), loop->pixels.end(), back_inserter(loop->simplifiedShape));
+    
+    for(int j = loop->length - minLength; j >= 0; j--){
+        
+        loop->simplifiedShape.clear();
+        copy(loop->pixels.begin(), loop->pixels.end(), back_inserter(loop->simplifiedShape));
+        
+        float error = visvalingam(loop->simplifiedShape, j, originalLength, loop->pixels, !pinEnds);
+        if(loop->length - j < loop->idealLength && error < localPolygonError){
+            loop->idealLength = loop->length - j;
+            loop->idealError = error;
+            break;
+        }
+    }
+    loop->simplifiedShape.clear();
+    copy(loop->pixels.begin(), loop->pixels.end(), back_inserter(loop->simplifiedShape));
+    float error = visvalingam(loop->simplifiedShape, loop->length - loop->idealLength, originalLength, loop->pixels, !pinEnds);
+    
+    /*
+    for(int i = 0; i < loop->simplifiedShape.size(); i++){
+        cout << loop->simplifiedShape[i].x << ", " << loop->simplifiedShape[i].y << endl;
+    }
+    */
+    
+    //cout << "Reduced loop from " << loop->length << " to " << loop->idealLength << ": error: " << error << endl;
+}
+
+void generatePolygons(ConvertContext &ctx, Image *debugImage, vector<Region*> &regions){
+
+    int totalVertices = 0;
+    int reducedVertices = 0;
+
+    if(debugImage != nullptr){
+        RgbaView debug = viewImage(*debugImage);
+        fill(debug.pixels, debug.pixels + (size_t)debug.stride * debug.height, WHITE);
+
+        for(int i = 0; i < regions.size(); i++){
+            for(int j = 0; j < regions[i]->loops.size(); j++){
+
+                for(int k = 0; k < regions[i]->loops[j]->pixels.size(); k++){
+                    //Crack loops run along pixel corners, which reach one past the last pixel
+                    Coordinate c = regions[i]->loops[j]->pixels[k];
+                    debug.at(min(c.x, debug.width-1), min(c.y, debug.height-1)) = PURPLE;
+                }
+            }
+        }
+    }
+
+    if(ctx.options.tracer == TRACER_CRACK){
+        //Borders shared by two regions are simplified once, as arcs between the junctions
+        vector<Loop*> arcs;
+        buildArcs(regions, arcs);
+        //A loop made of one or two arcs would shrink to a line between its junctions if they all went straight,
+        //so their arcs keep enough vertices between them for every loop to enclose an area
+        vector<int> minLengths(arcs.size(), 2);
+        for(int i = 0; i < regions.size(); i++){
+            for(int j = 0; j < regions[i]->loops.size(); j++){
+                Loop *loop = regions[i]->loops[j];
+                for(int k = 0; k < loop->arcs.size(); k++){
+                    int arc = loop->arcs[k].arc;
+                    int needed = arcs[arc]->closed ? 3 : (loop->arcs.size() == 1 ? 4 : (loop->arcs.size() == 2 ? 3 : 2));
+                    minLengths[arc] = max(minLengths[arc], needed);
+                }
+            }
+        }
+        int threads = stageThreads(ctx, arcs.size(), 256);
+        parallelFor(arcs.size(), threads, [&](int begin, int end, int /*t*/){
+            for(int i = begin; i < end; i++){
+                simplifyLoop(ctx, arcs[i], !arcs[i]->closed, minLengths[i]);
+            }
+        });
+        joinArcs(regions, arcs);
+        for(int i = 0; i < arcs.size(); i++){
+            totalVertices += arcs[i]->length;
+            reducedVertices += arcs[i]->idealLength;
+            delete arcs[i];
+        }
+        if(ctx.options.verbose)
+            cout << "Simplified " << arcs.size() << " shared borders" << endl;
+    }
+    else {
+        for(int i = 0; i < regions.size(); i++){
+            for(int j = 0; j < regions[i]->loops.size(); j++){
+                Loop *loop = regions[i]->loops[j];
+                simplifyLoop(ctx, loop, false, 3);
+                totalVertices += loop->length;
+                reducedVertices += loop->idealLength;
+            }
+        }
+    }
+
+    if(ctx.options.verbose){
+        cout << "Completed polygon generation" << endl;
+        cout << "Reduced scene vertices from " << totalVertices << " to " << reducedVertices << endl;
+    }
+}
+
+
+
+bool compareAreas(const Loop *a, const Loop *b){
+  return a->area > b->area;
+}
+
+typedef struct Bezier {
+    float x1, y1, cx1, cy1, cx2, cy2, x2, y2;
+} Bezier;
+
+/*
+Creates a Centripetal Catmull-Rom Spline using 4 vertices
+Then converts to a bezier format that can be rendered
+
+https://en.wikipedia.org/wiki/Centripetal_Catmull%E2%80%93Rom_spline
+Centripetal Catmull Rom Spline Implementation
+  
+Converting to cubic bezier
+https://stackoverflow.com/questions/30748316/catmull-rom-interpolation-on-svg-paths
+*/
+void CalculateBezierFromCatmullRom(Bezier &bezier, int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3){
+    float t[] = {0, 0, 0, 0};
+    float px[] = {(float)x0, (float)x1, (float)x2, (float)x3};
+    float py[] = {(float)y0, (float)y1, (float)y2, (float)y3};
+
+    //Check for duplicates
+    for(int i = 0; i < 4; i++){
+        for(int j = 0; j < 4; j++){
+            if(i==j)
+                continue;
+            if(px[i] == px[j] && py[i] == py[j]){
+                bezier.x1 = x1;
+                bezier.y1 = y1;
+                bezier.x2 = x2;
+                bezier.y2 = y2;
+                bezier.cx1 = x1;
+                bezier.cy1 = y1;
+                bezier.cx2 = x2;
+                bezier.cy2 = y2;
+                return;
+            }
+        }
+    }
+
+    //centripetal
+    float a = 0.5;
+    for(int tv = 1; tv < 4; tv++){
+      
+      int tv2 = (tv-1);
+      float dX = px[tv] - px[tv2];
+      float dY = py[tv] - py[tv2];
+      dX = dX*dX;
+      dY = dY*dY;
+      float l = sqrt(dX + dY);
+      
+      t[tv] = pow(l, a) + t[tv-1];
+      
+    }
+
+    float c1 = (t[2] - t[1]) / (t[2] - t[0]);
+    float c2 = (t[1] - t[0]) / (t[2] - t[0]);
+    float d1 = (t[3]-t[2])/(t[3]-t[1]);
+    float d2 = (t[2]-t[1])/(t[3]-t[1]);
+
+    float m1[] = {0, 0};
+    float m2[] = {0, 0};
+
+    m1[0] = (t[2]-t[1])*(c1*(px[1] - px[0]) / (t[1]-t[0]) + c2 * (px[2] - px[1]) / (t[2]-t[1]));
+    m1[1] = (t[2]-t[1])*(c1*(py[1] - py[0]) / (t[1]-t[0]) + c2 * (py[2] - py[1]) / (t[2]-t[1]));
+
+
+    m2[0] = (t[2]-t[1])*(d1*(px[2]-px[1])/(t[2]-t[1]) + d2*(px[3]-px[2])/(t[3]-t[2]));
+    m2[1] = (t[2]-t[1])*(d1*(py[2]-py[1])/(t[2]-t[1]) + d2*(py[3]-py[2])/(t[3]-t[2]));
+
+
+    
+    float q1[] = {px[1] + m1[0] / 3.0f, py[1] + m1[1] / 3.0f};
+    float q2[] = {px[2] - m2[0] / 3.0f, py[2] - m2[1] / 3.0f};
+
+    bezier.x1 = x1;
+    bezier.y1 = y1;
+    bezier.x2 = x2;
+    bezier.y2 = y2;
+    bezier.cx1 = q1[0];
+    bezier.cy1 = q1[1];
+    bezier.cx2 = q2[0];
+    bezier.cy2 = q2[1];
+
+
+}
+
+const float cornerThreshold = 122;
+
+bool treatPointAsCorner(int x0, int y0, int x1, int y1, int x2, int y2){
+    //reverse a
+    Vector2 a = {(float)x0 - x1, (float)y0 - y1};
+    Vector2 b = {(float)x2 - x1, (float)y2 - y1};
+    float d = Vector2DotProduct(a, b);
+    float distA = Vector2Length(a);
+    float distB = Vector2Length(b);
+    float angle = acosf(d / (distA * distB));
+    float angleDegrees = angle * 180.0f / PI;
+
+    return angleDegrees < cornerThreshold;
+
+}
+
+
+/*
+Path data of one simplified loop, straight segments or curves through its vertices when smoothing
+Segments ending at a junction stay straight: the vertices around a junction differ between
+the regions meeting there, and only segments inside a shared border come out the same from both sides
+*/
+void writeLoopPath(ostream &userFile, Loop *loop, bool smoothEdges){
+    int n = loop->idealLength;
+    vector<Coordinate> &shape = loop->simplifiedShape;
+    auto junction = [&](int i){
+        return i < loop->simplifiedJunctions.size() && loop->simplifiedJunctions[i];
+    };
+    bool curve = false;
+    if(smoothEdges && (n > 5 || junction(0))){
+        curve = true;
+    }
+    userFile << "M ";
+    userFile << shape[0].x << " " << shape[0].y;
+    
+    for(int j = 0; j < n; j+=1){
+        int h = (j-1+n)%n;
+        int k = (j+1)%n;
+        int l = (k+1)%n;
+        if(!curve){
+            //The fill closes the path back to the first vertex
+            if(k != 0){
+                userFile << " L " << shape[k].x << " " << shape[k].y;
+            }
+            continue;
+        }
+        
+        bool sharpCorner = treatPointAsCorner(shape[h].x, shape[h].y, shape[j].x, shape[j].y, shape[k].x, shape[k].y);
+        sharpCorner = sharpCorner | treatPointAsCorner(shape[j].x, shape[j].y, shape[k].x, shape[k].y, shape[l].x, shape[l].y);
+        sharpCorner = sharpCorner | junction(j) | junction(k);
+
+        Bezier b;
+        CalculateBezierFromCatmullRom(b, shape[h].x, shape[h].y, shape[j].x, shape[j].y,
+        shape[k].x, shape[k].y, shape[l].x, shape[l].y);
+
+        if(!sharpCorner){
+            userFile << " C ";
+            userFile << b.cx1 << " " << b.cy1 << " ";
+            userFile << b.cx2 << " " << b.cy2 << " ";
+            userFile << b.x2 << " " << b.y2;
+        }
+        else {
+            userFile << " L ";
+            userFile << b.x2 << " " << b.y2;
+        }
+    }
+}
+
+/*
+With the crack tracer every region is one path: its outer boundary followed by its holes,
+filled with the evenodd rule so each pixel is painted by a single region and transparent areas stay open
+Walk tracer regions only have an outer loop, they are painted largest first so the smaller ones
+land on top, and enclosed transparent areas are cut out of the scene with a mask
+*/
+void writeSVG(ConvertContext &ctx, ostream &userFile, vector<Region*> &regions, int width, int height){
+    bool smoothEdges = ctx.options.smoothEdges;
+    bool cutHoles = ctx.options.tracer == TRACER_CRACK;
+    vector<Region *> ordered;
+    for(int i = regions.size()-1; i >= 0; i--){
+        Loop *loop = regions[i]->loops[0];
+        
+        loop->area = calculateArea(loop->simplifiedShape);
+        //cout << loop->pixels.size() << ", " << loop->area << endl;
+        
+        ordered.push_back(regions[i]);
+        
+
+    }
+    if(ctx.options.verbose)
+        cout << "Calculated areas" << endl;
+
+    std::sort(ordered.begin(), ordered.end(), [](const Region *a, const Region *b){
+        return compareAreas(a->loops[0], b->loops[0]);
+    });
+    vector<Loop *> loops;
+    for(int i = 0; i < ordered.size(); i++){
+        loops.push_back(ordered[i]->loops[0]);
+    }
+
+    //Final round of refinement (remove anymore extraneous vertices)
+
+    float cullingThreshold = 5;
+    int removeCount = 0;
+    for(int k = 0; k < 1; k++){
+        bool removed = false;
+        for(int i = 0; i < loops.size(); i++){
+            //visvalingam(loops[i]->simplifiedShape, loops[i]->simplifiedShape.size()/2, loops[i]->simplifiedShape.size());
+            for(int j = loops[i]->simplifiedShape.size()-2; j >= 0; j--){
+
+                int l = j+1;
+                
+                int m = j-1;
+                if(m == -1){
+                    m = loops[i]->simplifiedShape.size()-1;
+                }
+
+                float d1 = Vector2Distance({(float)loops[i]->simplifiedShape[l].x, (float)loops[i]->simplifiedShape[l].y}, {(float)loops[i]->simplifiedShape[j].x, (float)loops[i]->simplifiedShape[j].y} );
+                float d2 = Vector2Distance({(float)loops[i]->simplifiedShape[j].x, (float)loops[i]->simplifiedShape[j].y}, {(float)loops[i]->simplifiedShape[m].x, (float)loops[i]->simplifiedShape[m].y} );
+                float d3 = Vector2Distance({(float)loops[i]->simplifiedShape[l].x, (float)loops[i]->simplifiedShape[l].y}, {(float)loops[i]->simplifiedShape[m].x, (float)loops[i]->simplifiedShape[m].y} );
+                //cout << d1 << "+" << d2 << " = " << d3 << "... " << (d3/(d1+d2))<< endl;
+                if(d2+d1 < cullingThreshold){
+                    //loops[i]->simplifiedShape.erase(loops[i]->simplifiedShape.begin() + j);
+                    //removed = true;
+                    //removeCount++;
+                }
+
+            }
+        }
+    }
+    if(ctx.options.verbose)
+        cout << "Cleared " << removeCount << " extra vertices" << endl;
+    //cout << "Sorted by area" << endl;
+    
+    userFile << "<svg width=\"" << width << "\" height = \"" << height << "\" xmlns=\"http://www.w3.org/2000/svg\">" << endl;
+    
+    //Enclosed transparent areas of the walk tracer are cut out of the scene
+    bool useMask = false;
+    for(int i = 0; i < loops.size(); i++){
+        if(!cutHoles && loops[i]->color.a == 0){
+            useMask = true;
+        }
+    }
+    if(useMask){
+        userFile << "<defs>\n<mask id=\"sceneMask\">" << endl;
+        userFile << "<rect width=\"" << width << "\" height=\"" << height << "\" fill=\"white\" />" << endl; 
+        for(int i = 0; i < loops.size(); i++){
+            if(loops[i]->color.a != 0 || loops[i]->idealLength < 3){
+                continue;
+            }
+            userFile << "<path d=\"";
+            writeLoopPath(userFile, loops[i], smoothEdges);
+            userFile << "\" fill=\"black\" />" << endl;
+        }
+        userFile << "</mask>\n</defs>" << endl;
+    }
+
+    //Add Polylines
+    for(int i = 0; i < ordered.size(); i++){
+        //Regions simplified down to a line or a point cover nothing
+        if(loops[i]->color.a == 0 || loops[i]->idealLength < 3){
+            continue;
+        }
+        userFile << "<path d=\"";
+        writeLoopPath(userFile, loops[i], smoothEdges);
+        for(int j = 1; cutHoles && j < ordered[i]->loops.size(); j++){
+            //Holes simplified down to a line or a point enclose nothing
+            if(ordered[i]->loops[j]->idealLength < 3){
+                continue;
+            }
+            userFile << " ";
+            writeLoopPath(userFile, ordered[i]->loops[j], smoothEdges);
+        }
+        userFile << "\" fill=\"rgb(" << +loops[i]->color.r << "," << +loops[i]->color.g << "," << +loops[i]->color.b << ")\"";
+        userFile << " fill-opacity=\"" << (int)((+loops[i]->color.a) / (255.0f) * 100.0f) << "%\"";
+        if(cutHoles){
+            userFile << " fill-rule=\"evenodd\"";
+        }
+        else if(useMask){
+            userFile << " mask=\"url(#sceneMask)\"";
+        }
+        userFile << "/>" << endl;
+    
+    }
+    
+    userFile << "</svg>" << endl;
+}
+
+bool writeToFile(ConvertContext &ctx, string path, vector<Region*> &regions, Image &reference){
+    if(ctx.options.verbose)
+        cout << "Writing to " << path << endl;
+
+    ofstream userFile(path);
+    if(userFile.is_open()){
+        writeSVG(ctx, userFile, regions, reference.width, reference.height);
+        if(ctx.options.verbose)
+            cout << "Wrote to file: " << path << endl;
+        userFile.close();
+    }
+    else {
+        cout << "Failed to write to file " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+void freeRegions(vector<Region*> &regions){
+    for(int i = 0; i < regions.size(); i++){
+        for(int j = 0; j < regions[i]->loops.size(); j++){
+            delete regions[i]->loops[j];
+        }
+        delete regions[i];
+    }
+    regions.clear();
+}
+
+/*
+Palette files hold one "r g b a" entry (0-255 each) per line, lines starting with # are comments
+*/
+bool loadPalette(string path, vector<ColorRecord> &palette){
+    ifstream paletteFile(path);
+    if(!paletteFile.is_open()){
+        cout << "Failed to open palette " << path << endl;
+        return false;
+    }
+    palette.clear();
+    string line;
+    while(getline(paletteFile, line)){
+        istringstream entry(line);
+        int r, g, b, a;
+        if(line.empty() || line[0] == '#' || !(entry >> r)){
+            continue;
+        }
+        if(!(entry >> g >> b >> a) || r < 0 || r > 255 || g < 0 || g > 255 || b < 0 || b > 255 || a < 0 || a > 255){
+            cout << "Invalid palette entry in " << path << ": " << line << endl;
+            return false;
+        }
+        palette.push_back({(unsigned char)r, (unsigned char)g, (unsigned char)b, (unsigned char)a, 0});
+    }
+    return true;
+}
+
+bool savePalette(string path, const vector<ColorRecord> &palette){
+    ofstream paletteFile(path);
+    if(!paletteFile.is_open()){
+        cout << "Failed to write to file " << path << endl;
+        return false;
+    }
+    paletteFile << "# r g b a" << endl;
+    for(int i = 0; i < palette.size(); i++){
+        paletteFile << +palette[i].r << " " << +palette[i].g << " " << +palette[i].b << " " << +palette[i].a << endl;
+    }
+    return paletteFile.good();
+}
+
+//reduceColors only reads the pixels, so a const buffer can be wrapped without copying
+Image wrapPixels(const uint8_t *rgba, int width, int height){
+    Image image;
+    image.data = (void *)rgba;
+    image.width = width;
+    image.height = height;
+    image.mipmaps = 1;
+    image.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+    return image;
+}
+
+//Rejects settings no conversion can run with
+void checkOptions(const ConvertOptions &opts){
+    if(opts.palette.empty() && (opts.numColors < 1 || opts.numColors > maxNumColors)){
+        throw invalid_argument("numColors must be between 1 and " + to_string(maxNumColors) + ", got " + to_string(opts.numColors));
+    }
+    if(opts.hashWidth < 1){
+        throw invalid_argument("hashWidth must be at least 1, got " + to_string(opts.hashWidth));
+    }
+    if(opts.lutBits < minLutBits || opts.lutBits > maxLutBits){
+        throw invalid_argument("lutBits must be between " + to_string(minLutBits) + " and " + to_string(maxLutBits) + ", got " + to_string(opts.lutBits));
+    }
+}
+
+shared_ptr<const PaletteMatcher> buildPaletteMatcher(const ConvertOptions &opts){
+    checkOptions(opts);
+    ConvertContext ctx(opts);
+    vector<ColorRecord> entries;
+    fixedPaletteEntries(opts.palette, entries);
+    shared_ptr<PaletteMatcher> matcher = make_shared<PaletteMatcher>(entries);
+    //Shared by many conversions, so in auto mode the lookup table is always worth building
+    usePaletteEngine(ctx, *matcher, SIZE_MAX);
+    return matcher;
+}
+
+vector<ColorRecord> extractPalette(const uint8_t *rgba, int width, int height, const ConvertOptions &opts){
+    checkOptions(opts);
+    ConvertContext ctx(opts);
+    Image image = wrapPixels(rgba, width, height);
+    //Only the palette is needed, the pixels are never labeled
+    vector<ColorRecord> recordedColors;
+    ColorHistogram colorData;
+    int stride;
+    pickPalette(ctx, viewImage(image), recordedColors, colorData, stride);
+    return recordedColors;
+}
+
+string convert(const uint8_t *rgba, int width, int height, const ConvertOptions &opts){
+    checkOptions(opts);
+    ConvertContext ctx(opts);
+    Image image = wrapPixels(rgba, width, height);
+
+    vector<ColorRecord> recordedColors;
+    LabelImage labels;
+    vector<Region*> regions;
+
+    reduceColors(ctx, image, recordedColors, labels);
+    refineBorders(ctx, labels, regions, nullptr);
+    generatePolygons(ctx, nullptr, regions);
+
+    ostringstream svg;
+    writeSVG(ctx, svg, regions, width, height);
+    freeRegions(regions);
+
+    return svg.str();
+}
+
+}
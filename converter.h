@@ -0,0 +1,210 @@
+#ifndef PTV_CONVERTER_H
+#define PTV_CONVERTER_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "raylib.h"
+
+/*
+PNG to SVG conversion pipeline
+
+The stages run in order:
+reduceColors -> refineBorders -> generatePolygons -> writeSVG / writeToFile
+
+All state of a conversion lives in a ConvertContext, so separate conversions
+can run on separate threads at the same time
+*/
+namespace ptv {
+
+typedef struct ColorRecord {
+    unsigned char r;
+    unsigned char g;
+    unsigned char b;
+    unsigned char a;
+    int count;
+} ColorRecord;
+
+
+typedef struct Coordinate {
+    int x;
+    int y;
+} Coordinate;
+
+//One of the shared borders (arcs, see topology.h) a loop runs along
+typedef struct ArcRef {
+    int arc;
+    //The loop runs along the arc from its last pixel to its first
+    bool reversed;
+} ArcRef;
+
+//A loop is a border of pixels between two colors
+//Its pixels are pixel corners with the crack tracer and pixel centers with the walk tracer
+typedef struct Loop {
+    bool closed;
+    int length;
+    int idealLength;
+    float idealError;
+    float area;
+    Color color;
+    std::vector<Coordinate> pixels;
+    std::vector<Coordinate> simplifiedShape;
+
+    //Crack tracer only: which pixels and simplified vertices are junctions,
+    //corners where the loop meets the borders of other regions or the image edge
+    std::vector<bool> junctions;
+    std::vector<bool> simplifiedJunctions;
+    //Crack tracer only: the arcs making up the loop, in order
+    std::vector<ArcRef> arcs;
+} Loop;
+
+//A region is a space of like-color pixels that may contain several loops
+//The first loop is the outer boundary of the region, with the crack tracer the others are its holes
+typedef struct Region {
+    Color color;
+    //Pixels of the region next to another region or the image edge, in column major order
+    //Only held between finding the regions and tracing their loops
+    std::vector<Coordinate> borderPixels;
+    std::vector<Loop*> loops;
+} Region;
+
+//Palette index of every pixel, produced by reduceColors and used by the later stages
+typedef struct LabelImage {
+    int width = 0;
+    int height = 0;
+    std::vector<uint16_t> labels;
+    //Color of each label, the last one is the transparent label with color {0, 0, 0, 0}
+    std::vector<Color> palette;
+    //Label of every fully transparent pixel (alpha 0), whatever its RGB values
+    uint16_t transparentLabel = 0;
+} LabelImage;
+
+//How reduceColors finds the closest palette entry for each color
+typedef enum {
+    //Lookup table when there are enough colors to pay for building it, search otherwise
+    PALETTE_ENGINE_AUTO = 0,
+    //Vectorized scan over the whole palette
+    PALETTE_ENGINE_SEARCH,
+    //Precomputed table from quantized RGBA to the few entries that can be closest
+    PALETTE_ENGINE_LUT
+} PaletteEngine;
+
+//How reduceColors picks the palette from the image colors
+typedef enum {
+    //Merge colors within hashWidth of each other, then keep the most common
+    QUANTIZER_SPATIAL_HASH = 0,
+    //Split the color space at weighted medians until there are numColors boxes
+    QUANTIZER_MEDIAN_CUT
+} Quantizer;
+
+//How refineBorders finds the areas of like-colored pixels
+typedef enum {
+    //Scanline flood fill from every pixel no region has taken yet
+    REGION_ENGINE_FLOOD_FILL = 0,
+    //Two raster passes with union-find, small regions are dropped by their stats before any border work
+    //Runs on bands of rows in parallel
+    REGION_ENGINE_UNION_FIND
+} RegionEngine;
+
+//How refineBorders turns the border of each region into loops
+typedef enum {
+    //Follows the cracks between pixels on the label plane, loops are exact, closed and run along pixel corners
+    TRACER_CRACK = 0,
+    //Walks from border pixel to border pixel (through pixel centers), jumping to the nearest one when stuck
+    TRACER_WALK
+} Tracer;
+
+struct PaletteMatcher;
+
+//Range of ConvertOptions::lutBits, tables outside it are either too coarse to help or too large to build
+const int minLutBits = 3;
+const int maxLutBits = 6;
+
+//Largest palette a conversion can use: one label is kept for transparency and the top bit of a label marks cleared pixels
+const int maxNumColors = 0x7FFF - 1;
+
+//User settings for a single conversion
+typedef struct ConvertOptions {
+    //Size of the reduced palette, 1 to maxNumColors
+    int numColors = 16;
+    //Average distance (in pixels) a simplified polygon may stray from its border
+    float polygonError = 5.0f;
+    Quantizer quantizer = QUANTIZER_SPATIAL_HASH;
+    //Colors closer than this are merged before the palette is chosen (spatial hash quantizer), at least 1
+    int hashWidth = 10;
+    //Maximum rounds of k-means refinement applied to the chosen palette, 0 disables it
+    int kmeansIterations = 0;
+    //The palette is picked from every sampleStride-th pixel of every sampleStride-th row
+    //1 counts every pixel, 0 picks a stride from the image size (for very large images)
+    int sampleStride = 1;
+    //How much worse (average RGBA distance) a sampled palette may fit a second, offset sample
+    //than the pixels it was built from before a denser sample is taken, 0 skips the check
+    float sampleErrorBound = 0.0f;
+    RegionEngine regionEngine = REGION_ENGINE_UNION_FIND;
+    Tracer tracer = TRACER_CRACK;
+    //Emit bezier curves instead of straight segments
+    bool smoothEdges = false;
+    //Print progress of each stage to stdout
+    bool verbose = false;
+    //Worker threads each stage may use, 0 uses one per core
+    //Keep the default of 1 when running many conversions side by side
+    int threads = 1;
+    //Fixed palette used instead of picking one from the image, so a set of images shares its colors
+    //Entries keep their order, numColors and the quantizer settings are ignored while it is set
+    std::vector<ColorRecord> palette;
+    //Matcher of palette from buildPaletteMatcher, so conversions sharing the palette also share its lookup table
+    //Left empty (or built from another palette), each conversion builds its own
+    std::shared_ptr<const PaletteMatcher> paletteMatcher;
+    PaletteEngine paletteEngine = PALETTE_ENGINE_AUTO;
+    //Bits per RGB channel of the palette lookup table, minLutBits to maxLutBits
+    int lutBits = 5;
+} ConvertOptions;
+
+//Working state of one conversion, passed to every stage
+typedef struct ConvertContext {
+    ConvertOptions options;
+
+    ConvertContext(const ConvertOptions &opts) : options(opts) {}
+} ConvertContext;
+
+//Helpers shared by the pipeline stages
+//Number of worker threads a stage should use for the given amount of work (pixels, colors...)
+int stageThreads(ConvertContext &ctx, size_t work, size_t minWorkPerThread);
+//Splits [0, count) into one contiguous block per thread, the calling thread runs the first block
+void parallelFor(int count, int threads, const std::function<void(int begin, int end, int thread)> &body);
+
+//Hash quantizer: merges recorded colors closer than hashWidth into the most common of them, keeping the total count
+void mergeSimilarColors(ConvertContext &ctx, std::vector<ColorRecord> &recordedColors);
+void reduceColors(ConvertContext &ctx, Image &image, std::vector<ColorRecord> &recordedColors, LabelImage &labels);
+//Draws the palette color of every label into an image of the same size (for the visualizer)
+void paintLabels(const LabelImage &labels, Image &image);
+//With the crack tracer, areas too small to become a region are merged into a neighbor in labels first
+//debugImage is only needed by the visualizer, pass nullptr to skip drawing the region borders
+void refineBorders(ConvertContext &ctx, LabelImage &labels, std::vector<Region*> &regions, Image *debugImage);
+//debugImage is only needed by the visualizer, pass nullptr to skip drawing the traced loops
+void generatePolygons(ConvertContext &ctx, Image *debugImage, std::vector<Region*> &regions);
+void writeSVG(ConvertContext &ctx, std::ostream &out, std::vector<Region*> &regions, int width, int height);
+bool writeToFile(ConvertContext &ctx, std::string path, std::vector<Region*> &regions, Image &reference);
+void freeRegions(std::vector<Region*> &regions);
+
+//Palette files hold one "r g b a" line per entry, for ConvertOptions::palette
+bool loadPalette(std::string path, std::vector<ColorRecord> &palette);
+bool savePalette(std::string path, const std::vector<ColorRecord> &palette);
+//Matcher of opts.palette with its lookup table (unless paletteEngine is search), built once for ConvertOptions::paletteMatcher
+//Throws std::invalid_argument when opts.hashWidth or opts.lutBits is out of range
+std::shared_ptr<const PaletteMatcher> buildPaletteMatcher(const ConvertOptions &opts);
+//Palette reduceColors would pick for a tightly packed RGBA8 buffer, to share with other conversions
+//Throws std::invalid_argument when opts.numColors (without a fixed palette), opts.hashWidth or opts.lutBits is out of range
+std::vector<ColorRecord> extractPalette(const uint8_t *rgba, int width, int height, const ConvertOptions &opts);
+
+//Converts a tightly packed RGBA8 buffer and returns the SVG document
+//Safe to call from several threads at once
+//Throws std::invalid_argument when opts.numColors (without a fixed palette), opts.hashWidth or opts.lutBits is out of range
+std::string convert(const uint8_t *rgba, int width, int height, const ConvertOptions &opts);
+
+}
+
+#endif
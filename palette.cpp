@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include "palette.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PTV_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace ptv {
+
+//Padding entries sit far outside the color cube so they never win, while distances still fit in 32 bits
+const int32_t paddingChannel = 8192;
+
+int nearestScalar(const PaletteMatcher &p, Color c){
+    int best = 0;
+    int bestDist = INT_MAX;
+    for(int i = 0; i < p.size; i++){
+        int dr = c.r - p.r[i];
+        int dg = c.g - p.g[i];
+        int db = c.b - p.b[i];
+        int da = c.a - p.a[i];
+        int dist = dr*dr + dg*dg + db*db + da*da;
+        if(dist < bestDist){
+            bestDist = dist;
+            best = i;
+        }
+    }
+    return best;
+}
+
+#ifdef PTV_X86_KERNELS
+
+/*
+Each lane keeps the best distance and index of the entries it has seen
+Entries reach a lane in increasing order and only a strictly smaller distance replaces the best,
+so taking the smallest index among the lanes holding the minimum gives the first closest entry
+*/
+int reduceLanes(const int32_t *dist, const int32_t *index, int lanes){
+    int best = index[0];
+    int bestDist = dist[0];
+    for(int l = 1; l < lanes; l++){
+        if(dist[l] < bestDist || (dist[l] == bestDist && index[l] < best)){
+            bestDist = dist[l];
+            best = index[l];
+        }
+    }
+    return best;
+}
+
+__attribute__((target("avx2")))
+int nearestAVX2(const PaletteMatcher &p, Color c){
+    __m256i cr = _mm256_set1_epi32(c.r);
+    __m256i cg = _mm256_set1_epi32(c.g);
+    __m256i cb = _mm256_set1_epi32(c.b);
+    __m256i ca = _mm256_set1_epi32(c.a);
+    __m256i bestDist = _mm256_set1_epi32(INT_MAX);
+    __m256i bestIndex = _mm256_setzero_si256();
+    __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i step = _mm256_set1_epi32(8);
+
+    for(int i = 0; i < (int)p.r.size(); i += 8){
+        __m256i dr = _mm256_sub_epi32(cr, _mm256_loadu_si256((const __m256i *)&p.r[i]));
+        __m256i dg = _mm256_sub_epi32(cg, _mm256_loadu_si256((const __m256i *)&p.g[i]));
+        __m256i db = _mm256_sub_epi32(cb, _mm256_loadu_si256((const __m256i *)&p.b[i]));
+        __m256i da = _mm256_sub_epi32(ca, _mm256_loadu_si256((const __m256i *)&p.a[i]));
+        __m256i dist = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(dr, dr), _mm256_mullo_epi32(dg, dg)),
+                                        _mm256_add_epi32(_mm256_mullo_epi32(db, db), _mm256_mullo_epi32(da, da)));
+        __m256i closer = _mm256_cmpgt_epi32(bestDist, dist);
+        bestDist = _mm256_blendv_epi8(bestDist, dist, closer);
+        bestIndex = _mm256_blendv_epi8(bestIndex, index, closer);
+        index = _mm256_add_epi32(index, step);
+    }
+
+    alignas(32) int32_t dist[8];
+    alignas(32) int32_t idx[8];
+    _mm256_store_si256((__m256i *)dist, bestDist);
+    _mm256_store_si256((__m256i *)idx, bestIndex);
+    return reduceLanes(dist, idx, 8);
+}
+
+__attribute__((target("sse4.1")))
+int nearestSSE41(const PaletteMatcher &p, Color c){
+    __m128i cr = _mm_set1_epi32(c.r);
+    __m128i cg = _mm_set1_epi32(c.g);
+    __m128i cb = _mm_set1_epi32(c.b);
+    __m128i ca = _mm_set1_epi32(c.a);
+    __m128i bestDist = _mm_set1_epi32(INT_MAX);
+    __m128i bestIndex = _mm_setzero_si128();
+    __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i step = _mm_set1_epi32(4);
+
+    for(int i = 0; i < (int)p.r.size(); i += 4){
+        __m128i dr = _mm_sub_epi32(cr, _mm_loadu_si128((const __m128i *)&p.r[i]));
+        __m128i dg = _mm_sub_epi32(cg, _mm_loadu_si128((const __m128i *)&p.g[i]));
+        __m128i db = _mm_sub_epi32(cb, _mm_loadu_si128((const __m128i *)&p.b[i]));
+        __m128i da = _mm_sub_epi32(ca, _mm_loadu_si128((const __m128i *)&p.a[i]));
+        __m128i dist = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(dr, dr), _mm_mullo_epi32(dg, dg)),
+                                     _mm_add_epi32(_mm_mullo_epi32(db, db), _mm_mullo_epi32(da, da)));
+        __m128i closer = _mm_cmpgt_epi32(bestDist, dist);
+        bestDist = _mm_blendv_epi8(bestDist, dist, closer);
+        bestIndex = _mm_blendv_epi8(bestIndex, index, closer);
+        index = _mm_add_epi32(index, step);
+    }
+
+    alignas(16) int32_t dist[4];
+    alignas(16) int32_t idx[4];
+    _mm_store_si128((__m128i *)dist, bestDist);
+    _mm_store_si128((__m128i *)idx, bestIndex);
+    return reduceLanes(dist, idx, 4);
+}
+
+#endif
+
+typedef int (*NearestKernel)(const PaletteMatcher &p, Color c);
+
+typedef struct KernelChoice {
+    NearestKernel kernel;
+    const char *name;
+} KernelChoice;
+
+KernelChoice pickKernel(){
+#ifdef PTV_X86_KERNELS
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        return {nearestAVX2, "avx2"};
+    }
+    if(__builtin_cpu_supports("sse4.1")){
+        return {nearestSSE41, "sse4.1"};
+    }
+#endif
+    return {nearestScalar, "scalar"};
+}
+
+const KernelChoice &activeKernel(){
+    static const KernelChoice choice = pickKernel();
+    return choice;
+}
+
+const char *paletteKernelName(){
+    return activeKernel().name;
+}
+
+PaletteMatcher::PaletteMatcher(const vector<ColorRecord> &palette){
+    size = palette.size();
+    int padded = (size + 7) / 8 * 8;
+    r.assign(padded, paddingChannel);
+    g.assign(padded, paddingChannel);
+    b.assign(padded, paddingChannel);
+    a.assign(padded, paddingChannel);
+    for(int i = 0; i < size; i++){
+        r[i] = palette[i].r;
+        g[i] = palette[i].g;
+        b[i] = palette[i].b;
+        a[i] = palette[i].a;
+        colors.push_back({palette[i].r, palette[i].g, palette[i].b, palette[i].a});
+    }
+}
+
+//Alpha is nearly always fully opaque or fully clear, so it gets a coarser grid than RGB
+const int lutAlphaBits = 2;
+
+size_t PaletteMatcher::lookupTableCells(int bits){
+    return (size_t)1 << (3 * bits + lutAlphaBits);
+}
+
+int lookupCell(Color c, int bits){
+    int shift = 8 - bits;
+    return ((((c.r >> shift) << bits | (c.g >> shift)) << bits | (c.b >> shift)) << lutAlphaBits) | (c.a >> (8 - lutAlphaBits));
+}
+
+/*
+For a cell (a box in color space) an entry can only be the closest to some color in the box
+if its nearest point of the box is no further than the best worst case distance of any entry
+Scanning those candidates in palette order keeps the first-entry-wins tie rule of the search
+*/
+bool PaletteMatcher::buildLookupTable(int bits, int threads){
+    if(size == 0 || size > 65535){
+        return false;
+    }
+    bits = max(minLutBits, min(maxLutBits, bits));
+    int cellCount = lookupTableCells(bits);
+
+    //Squared distances per channel from each entry to each slice of the grid, nearest and furthest
+    int sides[4] = {1 << bits, 1 << bits, 1 << bits, 1 << lutAlphaBits};
+    const vector<int32_t> *channels[4] = {&r, &g, &b, &a};
+    vector<int32_t> nearDist[4];
+    vector<int32_t> farDist[4];
+    for(int ch = 0; ch < 4; ch++){
+        int width = 256 / sides[ch];
+        nearDist[ch].resize((size_t)sides[ch] * size);
+        farDist[ch].resize((size_t)sides[ch] * size);
+        for(int slice = 0; slice < sides[ch]; slice++){
+            int lo = slice * width;
+            int hi = lo + width - 1;
+            for(int i = 0; i < size; i++){
+                int v = (*channels[ch])[i];
+                int dNear = v < lo ? lo - v : (v > hi ? v - hi : 0);
+                int dFar = max(abs(v - lo), abs(v - hi));
+                nearDist[ch][(size_t)slice * size + i] = dNear * dNear;
+                farDist[ch][(size_t)slice * size + i] = dFar * dFar;
+            }
+        }
+    }
+
+    vector<vector<uint16_t>> partialCandidates(max(1, threads));
+    vector<uint32_t> counts(cellCount);
+    parallelFor(cellCount, threads, [&](int begin, int end, int t){
+        vector<uint16_t> &candidates = partialCandidates[t];
+        vector<int32_t> cellNear(size);
+        for(int cell = begin; cell < end; cell++){
+            int sa = cell & (sides[3] - 1);
+            int sb = (cell >> lutAlphaBits) & (sides[2] - 1);
+            int sg = (cell >> (lutAlphaBits + bits)) & (sides[1] - 1);
+            int sr = cell >> (lutAlphaBits + 2 * bits);
+            const int32_t *nr = &nearDist[0][(size_t)sr * size], *ng = &nearDist[1][(size_t)sg * size];
+            const int32_t *nb = &nearDist[2][(size_t)sb * size], *na = &nearDist[3][(size_t)sa * size];
+            const int32_t *fr = &farDist[0][(size_t)sr * size], *fg = &farDist[1][(size_t)sg * size];
+            const int32_t *fb = &farDist[2][(size_t)sb * size], *fa = &farDist[3][(size_t)sa * size];
+
+            int32_t bound = INT_MAX;
+            for(int i = 0; i < size; i++){
+                cellNear[i] = nr[i] + ng[i] + nb[i] + na[i];
+                bound = min(bound, fr[i] + fg[i] + fb[i] + fa[i]);
+            }
+            uint32_t count = 0;
+            for(int i = 0; i < size; i++){
+                if(cellNear[i] <= bound){
+                    candidates.push_back(i);
+                    count++;
+                }
+            }
+            counts[cell] = count;
+        }
+    });
+
+    lutOffsets.assign(cellCount + 1, 0);
+    for(int cell = 0; cell < cellCount; cell++){
+        lutOffsets[cell + 1] = lutOffsets[cell] + counts[cell];
+    }
+    lutCandidates.clear();
+    lutCandidates.reserve(lutOffsets[cellCount]);
+    for(int t = 0; t < partialCandidates.size(); t++){
+        lutCandidates.insert(lutCandidates.end(), partialCandidates[t].begin(), partialCandidates[t].end());
+    }
+    lutBits = bits;
+    return true;
+}
+
+int PaletteMatcher::nearestIndex(Color c) const {
+    if(lutBits == 0){
+        return activeKernel().kernel(*this, c);
+    }
+
+    int cell = lookupCell(c, lutBits);
+    uint32_t begin = lutOffsets[cell];
+    uint32_t end = lutOffsets[cell + 1];
+    if(end - begin == 1){
+        return lutCandidates[begin];
+    }
+    int best = 0;
+    int bestDist = INT_MAX;
+    for(uint32_t k = begin; k < end; k++){
+        int i = lutCandidates[k];
+        int dr = c.r - r[i];
+        int dg = c.g - g[i];
+        int db = c.b - b[i];
+        int da = c.a - a[i];
+        int dist = dr*dr + dg*dg + db*db + da*da;
+        if(dist < bestDist){
+            bestDist = dist;
+            best = i;
+        }
+    }
+    return best;
+}
+
+}
@@ -0,0 +1,54 @@
+#ifndef PTV_PALETTE_H
+#define PTV_PALETTE_H
+
+#include <cstdint>
+#include <vector>
+#include "converter.h"
+
+namespace ptv {
+
+/*
+Finds the closest palette entry for a color (euclidean RGBA distance, first entry wins ties)
+
+The palette is kept as one array per channel, padded to a multiple of 8 entries,
+so one pixel can be compared against 8 entries at once with SSE4.1 or AVX2
+The kernel is picked at runtime from what the CPU supports
+
+buildLookupTable() optionally precomputes, for every cell of a quantized RGBA grid,
+the entries that can be closest to some color in that cell
+Most cells end up with a single candidate, making lookups O(1) while staying exact
+*/
+typedef struct PaletteMatcher {
+    std::vector<int32_t> r;
+    std::vector<int32_t> g;
+    std::vector<int32_t> b;
+    std::vector<int32_t> a;
+    std::vector<Color> colors;
+    //Real entries, the arrays above are padded past this
+    int size;
+
+    //Bits per RGB channel of the lookup table, 0 when there is none
+    int lutBits = 0;
+    //Candidates of cell i are lutCandidates[lutOffsets[i]] to lutCandidates[lutOffsets[i+1]-1]
+    std::vector<uint32_t> lutOffsets;
+    std::vector<uint16_t> lutCandidates;
+
+    PaletteMatcher(const std::vector<ColorRecord> &palette);
+
+    //Returns false (and keeps searching) if the palette is too large to index with 16 bits
+    bool buildLookupTable(int bits, int threads);
+    //Number of cells a table with the given bits has, to weigh its build cost
+    static size_t lookupTableCells(int bits);
+
+    int nearestIndex(Color c) const;
+    Color nearest(Color c) const {
+        return size > 0 ? colors[nearestIndex(c)] : c;
+    }
+} PaletteMatcher;
+
+//Name of the nearest color kernel this CPU uses ("avx2", "sse4.1" or "scalar")
+const char *paletteKernelName();
+
+}
+
+#endif
@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "../components.h"
+#include "../contours.h"
+#include "../converter.h"
+#include "../topology.h"
+
+using namespace std;
+using namespace ptv;
+
+int failures = 0;
+
+void check(bool passed, string what){
+    if(!passed){
+        cout << "FAILED: " << what << endl;
+        failures++;
+    }
+}
+
+//Loop around the given corners, with a junction at the first one only
+Loop *oneJunctionLoop(vector<Coordinate> corners){
+    Loop *loop = new Loop();
+    loop->closed = true;
+    loop->color = {255, 255, 255, 255};
+    loop->pixels = corners;
+    loop->length = corners.size();
+    loop->junctions.assign(corners.size(), false);
+    loop->junctions[0] = true;
+    return loop;
+}
+
+//A loop meeting other borders at a single corner is one arc from that corner all the way round
+void testOneJunctionLoop(){
+    Region *region = new Region();
+    region->loops.push_back(oneJunctionLoop({{0, 0}, {0, 4}, {4, 4}, {4, 0}}));
+    vector<Region*> regions = {region};
+    vector<Loop*> arcs;
+    buildArcs(regions, arcs);
+
+    check(arcs.size() == 1, "one junction loop makes a single arc");
+    check(region->loops[0]->arcs.size() == 1, "one junction loop runs along a single arc");
+    if(arcs.size() == 1){
+        check(!arcs[0]->closed, "one junction arc is open");
+        check(arcs[0]->pixels.size() == 5, "one junction arc keeps every corner");
+        check(arcs[0]->pixels.back().x == 0 && arcs[0]->pixels.back().y == 0, "one junction arc ends at its junction");
+        arcs[0]->simplifiedShape = arcs[0]->pixels;
+        arcs[0]->idealLength = arcs[0]->pixels.size();
+    }
+    joinArcs(regions, arcs);
+    check(region->loops[0]->idealLength == 4, "one junction loop joins back to its corners");
+
+    for(int i = 0; i < arcs.size(); i++){
+        delete arcs[i];
+    }
+    freeRegions(regions);
+}
+
+//Count of the paths in an SVG document and of the subpaths in the first one
+void countPaths(const string &svg, int &paths, int &firstSubpaths){
+    paths = 0;
+    firstSubpaths = 0;
+    size_t at = 0;
+    while((at = svg.find("<path d=\"", at)) != string::npos){
+        size_t end = svg.find('"', at + 9);
+        if(paths == 0){
+            for(size_t i = at + 9; i < end; i++){
+                firstSubpaths += svg[i] == 'M';
+            }
+        }
+        paths++;
+        at = end;
+    }
+}
+
+/*
+A red ring on white whose ends only touch diagonally: the white inside meets the white outside
+at that one corner, so the hole of the background and the inside area each have a single junction
+*/
+void testDiagonalRing(){
+    int scale = 8;
+    int width = 20 * scale, height = 20 * scale;
+    vector<uint8_t> pixels(width * height * 4, 255);
+    auto red = [&](int x, int y){
+        for(int v = 0; v < scale; v++){
+            for(int u = 0; u < scale; u++){
+                uint8_t *p = &pixels[((y * scale + v) * width + x * scale + u) * 4];
+                p[1] = 0;
+                p[2] = 0;
+            }
+        }
+    };
+    for(int i = 4; i <= 15; i++){
+        red(i, 4);
+        red(15, i);
+    }
+    for(int i = 5; i <= 15; i++){
+        red(i, 15);
+    }
+    for(int y = 4; y <= 9; y++){
+        red(4, y);
+    }
+    for(int y = 10; y <= 15; y++){
+        red(5, y);
+    }
+
+    ConvertOptions options;
+    string svg = convert(pixels.data(), width, height, options);
+    int paths, backgroundSubpaths;
+    countPaths(svg, paths, backgroundSubpaths);
+    check(paths == 3, "diagonal ring gives the background, the ring and the inside");
+    check(backgroundSubpaths == 2, "background keeps the hole of the diagonal ring");
+
+    options.smoothEdges = true;
+    options.quantizer = QUANTIZER_MEDIAN_CUT;
+    options.kmeansIterations = 4;
+    options.sampleStride = 2;
+    svg = convert(pixels.data(), width, height, options);
+    countPaths(svg, paths, backgroundSubpaths);
+    check(paths == 3, "smoothed diagonal ring gives three paths");
+}
+
+//Merging alike colors moves pixels between them but never adds or loses any
+void testMergeKeepsPixelCount(){
+    vector<ColorRecord> colors;
+    int64_t pixels = 0;
+    unsigned int seed = 1;
+    auto next = [&](){
+        seed = seed * 1103515245 + 12345;
+        return (int)(seed >> 16);
+    };
+    //Clusters of close colors, with counts growing so each merge keeps finding a new dominant
+    for(int cluster = 0; cluster < 40; cluster++){
+        int r = next() % 256, g = next() % 256, b = next() % 256;
+        for(int k = 0; k < 60; k++){
+            ColorRecord c;
+            c.r = (unsigned char)min(255, r + next() % 12);
+            c.g = (unsigned char)min(255, g + next() % 12);
+            c.b = (unsigned char)min(255, b + next() % 12);
+            c.a = 255;
+            c.count = 1000 + k * 7919 + next() % 100;
+            colors.push_back(c);
+            pixels += c.count;
+        }
+    }
+
+    ConvertOptions options;
+    ConvertContext ctx(options);
+    mergeSimilarColors(ctx, colors);
+
+    int64_t merged = 0;
+    for(int i = 0; i < colors.size(); i++){
+        check(colors[i].count > 0, "merged colors all have pixels");
+        merged += colors[i].count;
+    }
+    check(colors.size() < 40 * 60, "alike colors merge");
+    check(merged == pixels, "merged counts add up to the pixel count");
+}
+
+//A palette size outside the label space is refused instead of overflowing it
+void testColorCountRange(){
+    vector<uint8_t> pixels(4 * 4 * 4, 255);
+    ConvertOptions options;
+    for(int numColors : {0, -3, maxNumColors + 1}){
+        options.numColors = numColors;
+        bool refused = false;
+        try {
+            convert(pixels.data(), 4, 4, options);
+        }
+        catch(const invalid_argument &){
+            refused = true;
+        }
+        check(refused, "convert refuses " + to_string(numColors) + " colors");
+    }
+    options.numColors = 1;
+    check(!convert(pixels.data(), 4, 4, options).empty(), "convert takes a single color");
+
+    //The hash quantizer divides by its merge distance
+    vector<uint8_t> colors(64 * 64 * 4, 255);
+    for(int i = 0; i < 64 * 64; i++){
+        colors[i * 4 + i % 4 % 3] = (uint8_t)(i % 4 * 60);
+    }
+    options.numColors = 2;
+    options.hashWidth = 0;
+    bool refused = false;
+    try {
+        convert(colors.data(), 64, 64, options);
+    }
+    catch(const invalid_argument &){
+        refused = true;
+    }
+    check(refused, "convert refuses a hash width of 0");
+
+    //The lookup table grid is 1 << (3 * lutBits) cells
+    options.hashWidth = 10;
+    for(int lutBits : {-4, 2, 7, 30}){
+        options.lutBits = lutBits;
+        refused = false;
+        try {
+            convert(colors.data(), 64, 64, options);
+        }
+        catch(const invalid_argument &){
+            refused = true;
+        }
+        check(refused, "convert refuses " + to_string(lutBits) + " lookup table bits");
+    }
+}
+
+//Conversions with a fixed palette come out the same with or without its prebuilt matcher
+void testPrebuiltMatcher(){
+    int width = 64, height = 48;
+    vector<uint8_t> pixels(width * height * 4);
+    for(int y = 0; y < height; y++){
+        for(int x = 0; x < width; x++){
+            uint8_t *p = &pixels[(y * width + x) * 4];
+            p[0] = (uint8_t)(x * 4);
+            p[1] = (uint8_t)(y * 5);
+            p[2] = (uint8_t)((x / 16 + y / 12) * 60);
+            p[3] = 255;
+        }
+    }
+    ConvertOptions options;
+    options.numColors = 8;
+    options.palette = extractPalette(pixels.data(), width, height, options);
+    string own = convert(pixels.data(), width, height, options);
+
+    options.paletteEngine = PALETTE_ENGINE_LUT;
+    options.paletteMatcher = buildPaletteMatcher(options);
+    check(convert(pixels.data(), width, height, options) == own, "prebuilt matcher gives the same SVG");
+
+    //A matcher built from another palette is ignored
+    ConvertOptions other = options;
+    other.palette.pop_back();
+    options.paletteMatcher = buildPaletteMatcher(other);
+    check(convert(pixels.data(), width, height, options) == own, "mismatched prebuilt matcher is ignored");
+}
+
+//Label image of random size filled with up to 3 random labels, which makes many small areas with holes
+LabelImage randomLabels(mt19937 &rng, int maxSide){
+    LabelImage labels;
+    labels.width = 1 + rng() % maxSide;
+    labels.height = 1 + rng() % maxSide;
+    int count = 1 + rng() % 3;
+    labels.palette.assign(count, {0, 0, 0, 255});
+    labels.labels.resize((size_t)labels.width * labels.height);
+    for(int i = 0; i < labels.labels.size(); i++){
+        labels.labels[i] = rng() % count;
+    }
+    return labels;
+}
+
+//Labeling in bands finds the same components, with the same stats, as labeling the image in one piece
+void testComponentBands(){
+    mt19937 rng(3);
+    auto statsKey = [](const ComponentStats &c){
+        return make_tuple(c.firstX, c.firstY, c.label, c.area, c.minX, c.minY, c.maxX, c.maxY, c.borderPixels);
+    };
+    for(int trial = 0; trial < 3000; trial++){
+        LabelImage labels = randomLabels(rng, 70);
+        ComponentImage whole;
+        labelComponents(labels, whole, 1);
+        vector<decltype(statsKey(whole.stats[0]))> expected;
+        for(int i = 0; i < whole.stats.size(); i++){
+            expected.push_back(statsKey(whole.stats[i]));
+        }
+        std::sort(expected.begin(), expected.end());
+
+        for(int bands : {2, 3, 7, 64}){
+            ComponentImage banded;
+            labelComponents(labels, banded, bands);
+            vector<decltype(statsKey(whole.stats[0]))> found;
+            for(int i = 0; i < banded.stats.size(); i++){
+                found.push_back(statsKey(banded.stats[i]));
+            }
+            std::sort(found.begin(), found.end());
+            bool same = found == expected;
+            //Ids differ, but neighboring pixels must share a component in both or in neither
+            for(size_t p = 0; p < labels.labels.size() && same; p++){
+                for(size_t q : {p + 1, p + (size_t)labels.width}){
+                    if(q < labels.labels.size() && (whole.ids[p] == whole.ids[q]) != (banded.ids[p] == banded.ids[q])){
+                        same = false;
+                    }
+                }
+            }
+            if(!same){
+                check(false, "components of trial " + to_string(trial) + " in " + to_string(bands) + " bands match one band");
+                return;
+            }
+        }
+    }
+}
+
+//Crack traced loops of a component enclose exactly its pixels, and every crack on a border is walked once
+void testCrackLoopAreas(){
+    mt19937 rng(5);
+    for(int trial = 0; trial < 300; trial++){
+        LabelImage labels = randomLabels(rng, 40);
+        int width = labels.width, height = labels.height;
+        ComponentImage components;
+        labelComponents(labels, components, 1);
+
+        vector<vector<Coordinate>> borders(components.stats.size());
+        for(int y = 0; y < height; y++){
+            for(int x = 0; x < width; x++){
+                size_t p = (size_t)y * width + x;
+                uint16_t v = labels.labels[p];
+                if(x == 0 || y == 0 || x == width - 1 || y == height - 1 || labels.labels[p - 1] != v || labels.labels[p + 1] != v ||
+                   labels.labels[p - width] != v || labels.labels[p + width] != v){
+                    borders[components.ids[p]].push_back({x, y});
+                }
+            }
+        }
+
+        vector<uint8_t> visited((size_t)width * height, 0);
+        for(int id = 0; id < components.stats.size(); id++){
+            vector<Loop*> loops;
+            traceContours(labels, components.stats[id].label, borders[id], visited, loops);
+            //Shoelace sum, twice the signed area: the outer loop adds the pixels inside it, holes take theirs away
+            int64_t twiceArea = 0;
+            bool straight = true;
+            for(int j = 0; j < loops.size(); j++){
+                vector<Coordinate> &corners = loops[j]->pixels;
+                for(int k = 0; k < corners.size(); k++){
+                    Coordinate a = corners[k], b = corners[(k + 1) % corners.size()];
+                    straight = straight && (a.x == b.x || a.y == b.y);
+                    twiceArea += (int64_t)a.x * b.y - (int64_t)b.x * a.y;
+                }
+                delete loops[j];
+            }
+            if(!straight || twiceArea != 2 * (int64_t)components.stats[id].area){
+                check(false, "loops of component " + to_string(id) + " in trial " + to_string(trial) + " enclose its pixels");
+                return;
+            }
+        }
+
+        for(int y = 0; y < height; y++){
+            for(int x = 0; x < width; x++){
+                size_t p = (size_t)y * width + x;
+                const int sideX[4] = {0, 1, 0, -1}, sideY[4] = {-1, 0, 1, 0};
+                for(int side = 0; side < 4; side++){
+                    int nx = x + sideX[side], ny = y + sideY[side];
+                    bool border = nx < 0 || ny < 0 || nx >= width || ny >= height || labels.labels[(size_t)ny * width + nx] != labels.labels[p];
+                    if(border != (bool)(visited[p] & (1 << side))){
+                        check(false, "every border crack of trial " + to_string(trial) + " is traced");
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+
+int main(){
+    testOneJunctionLoop();
+    testDiagonalRing();
+    testMergeKeepsPixelCount();
+    testColorCountRange();
+    testPrebuiltMatcher();
+    testComponentBands();
+    testCrackLoopAreas();
+
+    if(failures > 0){
+        cout << failures << " checks failed" << endl;
+        return 1;
+    }
+    cout << "All checks passed" << endl;
+    return 0;
+}
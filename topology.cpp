@@ -0,0 +1,127 @@
+#include <unordered_map>
+#include "topology.h"
+
+using namespace std;
+
+namespace ptv {
+
+//Key of the crack from corner a one step towards corner b, the same whichever way it is walked
+uint64_t crackKey(Coordinate a, Coordinate b){
+    int dx = (b.x > a.x) - (b.x < a.x);
+    int dy = (b.y > a.y) - (b.y < a.y);
+    int x = dx < 0 ? a.x - 1 : a.x;
+    int y = dy < 0 ? a.y - 1 : a.y;
+    return (((uint64_t)(uint32_t)y << 32 | (uint32_t)x) << 2) | (dy != 0 ? 1 : 0);
+}
+
+//Key of a closed arc, its first corner in column major order
+uint64_t closedKey(Coordinate a){
+    return (((uint64_t)(uint32_t)a.y << 32 | (uint32_t)a.x) << 2) | 2;
+}
+
+void buildArcs(vector<Region*> &regions, vector<Loop*> &arcs){
+    //Arcs by the crack at either of their ends, or by the first corner of closed arcs
+    unordered_map<uint64_t, int> arcByKey;
+
+    for(int i = 0; i < regions.size(); i++){
+        for(int j = 0; j < regions[i]->loops.size(); j++){
+            Loop *loop = regions[i]->loops[j];
+            vector<Coordinate> &pixels = loop->pixels;
+            int n = pixels.size();
+            loop->arcs.clear();
+
+            int first = -1;
+            for(int k = 0; k < n && first < 0; k++){
+                if(loop->junctions[k]){
+                    first = k;
+                }
+            }
+
+            if(first < 0){
+                //The whole loop borders a single area, both sides start it from the same corner
+                int start = 0;
+                for(int k = 1; k < n; k++){
+                    if(pixels[k].x < pixels[start].x || (pixels[k].x == pixels[start].x && pixels[k].y < pixels[start].y)){
+                        start = k;
+                    }
+                }
+                uint64_t key = closedKey(pixels[start]);
+                auto found = arcByKey.find(key);
+                if(found != arcByKey.end()){
+                    loop->arcs.push_back({found->second, true});
+                    continue;
+                }
+                Loop *arc = new Loop();
+                arc->color = loop->color;
+                arc->closed = true;
+                for(int k = 0; k < n; k++){
+                    arc->pixels.push_back(pixels[(start + k) % n]);
+                }
+                arc->length = n;
+                arcByKey[key] = arcs.size();
+                loop->arcs.push_back({(int)arcs.size(), false});
+                arcs.push_back(arc);
+                continue;
+            }
+
+            //Walk from junction to junction, each stretch is an arc
+            int a = first;
+            do {
+                int b = (a + 1) % n;
+                while(!loop->junctions[b]){
+                    b = (b + 1) % n;
+                }
+                int last = (b - 1 + n) % n;
+                uint64_t startKey = crackKey(pixels[a], pixels[(a + 1) % n]);
+                auto found = arcByKey.find(startKey);
+                if(found != arcByKey.end()){
+                    //Traced from the other side already, where this stretch's first crack was its last one
+                    loop->arcs.push_back({found->second, true});
+                }
+                else {
+                    Loop *arc = new Loop();
+                    arc->color = loop->color;
+                    arc->closed = false;
+                    //A loop with a single junction comes back to it, so its one arc runs all the way round
+                    int k = a;
+                    do {
+                        arc->pixels.push_back(pixels[k]);
+                        k = (k + 1) % n;
+                    } while(k != b);
+                    arc->pixels.push_back(pixels[b]);
+                    arc->length = arc->pixels.size();
+                    arcByKey[startKey] = arcs.size();
+                    arcByKey[crackKey(pixels[b], pixels[last])] = arcs.size();
+                    loop->arcs.push_back({(int)arcs.size(), false});
+                    arcs.push_back(arc);
+                }
+                a = b;
+            } while(a != first);
+        }
+    }
+}
+
+void joinArcs(vector<Region*> &regions, const vector<Loop*> &arcs){
+    for(int i = 0; i < regions.size(); i++){
+        for(int j = 0; j < regions[i]->loops.size(); j++){
+            Loop *loop = regions[i]->loops[j];
+            loop->simplifiedShape.clear();
+            loop->simplifiedJunctions.clear();
+            for(int k = 0; k < loop->arcs.size(); k++){
+                const Loop *arc = arcs[loop->arcs[k].arc];
+                const vector<Coordinate> &shape = arc->simplifiedShape;
+                int count = arc->idealLength;
+                //An open arc ends where the next one starts, so its last vertex is left to the next arc
+                int used = arc->closed ? count : count - 1;
+                for(int m = 0; m < used; m++){
+                    int index = loop->arcs[k].reversed ? (arc->closed ? (count - m) % count : count - 1 - m) : m;
+                    loop->simplifiedShape.push_back(shape[index]);
+                    loop->simplifiedJunctions.push_back(!arc->closed && m == 0);
+                }
+            }
+            loop->idealLength = loop->simplifiedShape.size();
+        }
+    }
+}
+
+}
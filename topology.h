@@ -0,0 +1,35 @@
+#ifndef PTV_TOPOLOGY_H
+#define PTV_TOPOLOGY_H
+
+#include <vector>
+#include "converter.h"
+
+namespace ptv {
+
+/*
+Shared borders between regions
+
+Every crack between two areas belongs to the loops of both, traced once each way round
+Cutting the crack traced loops at their junctions gives arcs: stretches of border between one pair
+of areas (or an area and the image edge) that run from one junction to another
+A border with no junction on it, like the outline of an island, is a single closed arc
+
+Each arc is simplified once with its ends kept in place, then every loop running along it
+takes the same vertices, so neighboring regions meet exactly instead of each
+simplifying its own copy of the border
+*/
+
+/*
+Splits the loops of every region into arcs, filling each loop's arcs in order
+Arcs are Loops of their own (closed for the ones without junctions), owned by the caller
+The first loop to run along an arc traces it forwards, the region on the other side runs it reversed
+Loops must come from the crack tracer, with their junctions set
+*/
+void buildArcs(std::vector<Region*> &regions, std::vector<Loop*> &arcs);
+
+//Sets the simplified shape (and simplifiedJunctions) of every loop from the simplified shapes of its arcs
+void joinArcs(std::vector<Region*> &regions, const std::vector<Loop*> &arcs);
+
+}
+
+#endif